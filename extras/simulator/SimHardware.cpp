@@ -0,0 +1,123 @@
+/*
+ *  SimHardware.cpp
+ * 
+ *  This file is part of CommandStation.
+ *
+ *  CommandStation is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  CommandStation is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with CommandStation.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include "SimHardware.h"
+
+#include <EEPROM.h>
+#include <HardwareSerial.h>
+
+volatile uint8_t ADCSRA = 0;
+volatile uint8_t ADCSRB = 0;
+volatile uint8_t ADMUX = 0;
+volatile uint16_t ADC = 0;
+volatile uint16_t TCNT1 = 0;
+volatile uint16_t OCR1A = 0;
+volatile uint8_t TIFR1 = 0;
+EEPROMClass EEPROM;
+HardwareSerial Serial;
+
+uint32_t SimHardware::now = 0;
+uint8_t SimHardware::pinLevel[SimHardware::kPins];
+uint16_t SimHardware::analogValue[SimHardware::kPins];
+uint16_t (*SimHardware::analogSource)(uint8_t pin) = nullptr;
+bool SimHardware::adcBusy = false;
+uint32_t SimHardware::adcDone = 0;
+uint8_t SimHardware::adcPin = 0;
+uint32_t SimHardware::blockingReads = 0;
+std::vector<SimEdge> SimHardware::edgeLog;
+
+void SimHardware::reset() {
+  now = 0;
+  memset(pinLevel, 0, sizeof(pinLevel));
+  memset(analogValue, 0, sizeof(analogValue));
+  analogSource = nullptr;
+  edgeLog.clear();
+  // The ADC registers are left alone, a conversion that was asked for still
+  // runs once time moves
+  adcBusy = false;
+}
+
+void SimHardware::advance(uint32_t micros) {
+  uint32_t end = now + micros;
+  for(;;) {
+    if(!adcBusy && (ADCSRA & _BV(ADEN)) && (ADCSRA & _BV(ADSC))) {
+      adcBusy = true;
+      adcDone = now + kAdcConversionMicros;
+      adcPin = A0 + (ADMUX & 0x07) + ((ADCSRB & _BV(MUX5)) ? 8 : 0);
+    }
+    if(!adcBusy || adcDone > end) break;
+
+    // The input is read at the end of the conversion
+    now = adcDone;
+    adcBusy = false;
+    ADC = readAnalog(adcPin);
+    ADCSRA &= ~_BV(ADSC);
+    if(ADCSRA & _BV(ADIE)) simAdcVector();
+  }
+  now = end;
+}
+
+void SimHardware::setAnalog(uint8_t pin, uint16_t value) {
+  if(pin < kPins) analogValue[pin] = value;
+}
+
+void SimHardware::setAnalogSource(uint16_t (*source)(uint8_t pin)) {
+  analogSource = source;
+}
+
+void SimHardware::write(uint8_t pin, uint8_t value) {
+  if(pin >= kPins) return;
+  value = value ? HIGH : LOW;
+  if(pinLevel[pin] == value) return;
+  pinLevel[pin] = value;
+  SimEdge edge = {now, pin, value};
+  edgeLog.push_back(edge);
+}
+
+int SimHardware::readAnalog(uint8_t pin) {
+  if(analogSource != nullptr) return analogSource(pin);
+  if(pin >= kPins) return 0;
+  return analogValue[pin];
+}
+
+void pinMode(uint8_t pin, uint8_t mode) {
+  (void)pin;
+  (void)mode;
+}
+
+void digitalWrite(uint8_t pin, uint8_t val) {
+  SimHardware::write(pin, val);
+}
+
+int digitalRead(uint8_t pin) {
+  return SimHardware::level(pin);
+}
+
+int analogRead(uint8_t pin) {
+  return SimHardware::analogRead(pin);
+}
+
+unsigned long millis() {
+  return SimHardware::time() / 1000;
+}
+
+unsigned long micros() {
+  return SimHardware::time();
+}
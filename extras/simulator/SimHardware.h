@@ -0,0 +1,80 @@
+/*
+ *  SimHardware.h
+ * 
+ *  This file is part of CommandStation.
+ *
+ *  CommandStation is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  CommandStation is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with CommandStation.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef COMMANDSTATION_SIMULATOR_SIMHARDWARE_H_
+#define COMMANDSTATION_SIMULATOR_SIMHARDWARE_H_
+
+#include <Arduino.h>
+
+#include <vector>
+
+// A level change on an output pin, timestamped in simulated microseconds.
+struct SimEdge {
+  uint32_t time;
+  uint8_t pin;
+  uint8_t level;
+};
+
+// Simulated microcontroller behind the Arduino shim. Time only moves when the
+// simulator advances it, so every run is repeatable.
+class SimHardware {
+public:
+  static const uint8_t kPins = 70;
+
+  static void reset();
+  // Moves time on, finishing any ADC conversions that end on the way
+  static void advance(uint32_t micros);
+  static uint32_t time() { return now; }
+
+  // Value returned by analogRead on this pin (0-1023)
+  static void setAnalog(uint8_t pin, uint16_t value);
+  // Optional hook that computes the analog value at read time instead
+  static void setAnalogSource(uint16_t (*source)(uint8_t pin));
+  // Calls to analogRead, each of which waits for a conversion on a real board
+  static uint32_t analogReads() { return blockingReads; }
+
+  static uint8_t level(uint8_t pin) { return pin < kPins ? pinLevel[pin] : 0; }
+  static const std::vector<SimEdge>& edges() { return edgeLog; }
+  static void clearEdges() { edgeLog.clear(); }
+
+  // Called by the shim
+  static void write(uint8_t pin, uint8_t value);
+  static int readAnalog(uint8_t pin);
+  static int analogRead(uint8_t pin) {
+    blockingReads++;
+    return readAnalog(pin);
+  }
+
+  // Length of one conversion, at the prescaler CurrentSampler uses
+  static const uint32_t kAdcConversionMicros = 13;
+
+private:
+  static uint32_t now;
+  static bool adcBusy;
+  static uint32_t adcDone;
+  static uint8_t adcPin;
+  static uint32_t blockingReads;
+  static uint8_t pinLevel[kPins];
+  static uint16_t analogValue[kPins];
+  static uint16_t (*analogSource)(uint8_t pin);
+  static std::vector<SimEdge> edgeLog;
+};
+
+#endif  // COMMANDSTATION_SIMULATOR_SIMHARDWARE_H_
@@ -0,0 +1,1694 @@
+/*
+ *  Simulator.cpp
+ * 
+ *  This file is part of CommandStation.
+ *
+ *  CommandStation is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  CommandStation is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with CommandStation.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+// Host-side waveform simulator. Runs DCCMain and DCCService against simulated
+// pins, ADC and timer, records the track signal as an edge list, decodes it
+// back into packets and checks it against the NMRA timing rules. Exits with a
+// non-zero status if any check fails. See README.md for how to build it.
+
+#include <Arduino.h>
+#include <HardwareSerial.h>
+
+#include <EEPROM.h>
+
+#include <chrono>
+#include <math.h>
+#include <vector>
+
+#include "../../src/Accessories/EEStore.h"
+#include "../../src/Boards/MotorShields.h"
+#include "../../src/Boards/PowerBudget.h"
+#include "../../src/CommInterface/CommInterfaceSerial.h"
+#include "../../src/CommInterface/CommManager.h"
+#include "../../src/CommInterface/DCCEXParser.h"
+#include "../../src/CommInterface/LineAssembler.h"
+#include "../../src/DCC/DCCMain.h"
+#include "../../src/DCC/DCCService.h"
+#include "SimHardware.h"
+#include "TrackDecoder.h"
+#include "VirtualDecoder.h"
+
+// Period of the waveform timer, one tick of WaveformSchedule
+const uint32_t kTickMicros = 29;
+// Longest a dead short lasts before the sampler's fast trip cuts it, when 
+// the two sense pins share the ticks of one track: the first sample over the
+// limit can come a sample period after the short, then the rest follow
+const uint32_t kShortCutMicros = (kCurrentSamplerFastSamples + 1) * 2 * 
+  kCurrentSamplerTicks * kTickMicros;
+
+// Output that goes to stdout, used for callbacks
+class ConsolePrint : public Print {
+public:
+  size_t write(uint8_t c) { return fputc(c, stdout) == EOF ? 0 : 1; }
+};
+
+ConsolePrint console;
+HardwareSerial railcomSerial;
+
+int failures = 0;
+
+void check(bool condition, const char* what) {
+  printf("  %-52s %s\n", what, condition ? "ok" : "FAIL");
+  if(!condition) failures++;
+}
+
+void report(const TrackDecoder& decoder) {
+  printf("  decoded %u packets, %u ones, %u zeros, %u cutouts\n", 
+    (unsigned)decoder.packets().size(), decoder.ones(), decoder.zeros(), 
+    decoder.cutouts());
+  size_t shown = 0;
+  for(const Violation& v : decoder.violations()) {
+    if(shown++ == 10) {
+      printf("  ... %u more\n", (unsigned)(decoder.violations().size() - 10));
+      break;
+    }
+    printf("  %10uus %-10s %s\n", v.time, v.rule.c_str(), v.detail.c_str());
+  }
+}
+
+// Set to hold up the main loop for that long after its next pass (micros)
+uint32_t loopStall = 0;
+uint32_t stalledUntil = 0;
+
+// Runs the track for the given time, calling loop() about once a millisecond
+// like the sketch does. A decoder on the track sees the signal as it goes out.
+template<class Track>
+void run(Track& track, uint32_t micros, VirtualDecoder* decoder = nullptr) {
+  uint32_t end = SimHardware::time() + micros;
+  uint32_t nextLoop = SimHardware::time();
+  while(SimHardware::time() < end) {
+    if(track.interrupt1()) track.interrupt2();
+    if(decoder != nullptr) decoder->update();
+    if(SimHardware::time() >= stalledUntil) stalledUntil = 0;
+    if(SimHardware::time() >= nextLoop && stalledUntil == 0) {
+      track.loop();
+      nextLoop += 1000;
+      if(loopStall != 0) {
+        stalledUntil = SimHardware::time() + loopStall;
+        loopStall = 0;
+      }
+    }
+    SimHardware::advance(kTickMicros);
+  }
+}
+
+// Advances time and ticks the current sampler every waveform tick, as a 
+// track's interrupt does, for checks that run a board without its track
+void advanceSampled(uint32_t micros) {
+  static uint32_t nextTick = 0;
+  uint32_t end = SimHardware::time() + micros;
+  if(nextTick < SimHardware::time() || 
+    nextTick > SimHardware::time() + kTickMicros) 
+    nextTick = SimHardware::time();
+  while(nextTick <= end) {
+    SimHardware::advance(nextTick - SimHardware::time());
+    CurrentSampler::tick();
+    nextTick += kTickMicros;
+  }
+  SimHardware::advance(end - SimHardware::time());
+}
+
+std::vector<uint16_t> cvCallbackOrder;
+int lastCVValue;
+uint32_t lastCVTime;
+bool cvCallbackVerbose = true;
+
+void cvCallback(Print* stream, serviceModeResponse response) {
+  (void)stream;
+  cvCallbackOrder.push_back(response.cv);
+  lastCVValue = response.cvValue;
+  lastCVTime = SimHardware::time();
+  if(cvCallbackVerbose)
+    printf("  service mode callback: cv %u value %d\n", response.cv, 
+      response.cvValue);
+}
+
+decoderIdentityResponse lastIdentity;
+
+void identifyCallback(Print* stream, decoderIdentityResponse response) {
+  (void)stream;
+  lastIdentity = response;
+  lastCVTime = SimHardware::time();
+  if(cvCallbackVerbose)
+    printf("  identify callback: address %d manufacturer %d version %d "
+      "config %d\n", response.address, response.manufacturer, 
+      response.version, response.config);
+}
+
+std::vector<backupFrameResponse> backupFrames;
+
+void backupCallback(Print* stream, backupFrameResponse frame) {
+  (void)stream;
+  backupFrames.push_back(frame);
+  lastCVTime = SimHardware::time();
+}
+
+void POMCallback(Print* stream, RailcomPOMResponse response) {
+  (void)stream;
+  (void)response;
+}
+
+void trackPowerCallback(const char* name, bool status) {
+  (void)name;
+  (void)status;
+}
+
+uint16_t powerOns, powerOffs;
+
+void countPowerCallback(const char* name, bool status) {
+  (void)name;
+  if(status) powerOns++;
+  else powerOffs++;
+}
+
+void simulateMain() {
+  printf("Main track (railcom on)\n");
+  SimHardware::reset();
+
+  BoardConfigArduinoMotorShield boardConfig = {};
+  BoardArduinoMotorShield::getDefaultConfigA(boardConfig);
+  boardConfig.track_power_callback = trackPowerCallback;
+  static BoardArduinoMotorShield board(boardConfig);
+
+  RailComConfig railcomConfig = {};
+  Railcom::getDefaultConfig(railcomConfig);
+  railcomConfig.enable = true;
+  railcomConfig.serial = &railcomSerial;
+  static Railcom railcom(railcomConfig);
+
+  static DCCMain track(10, &board, &railcom);
+  board.setup();
+  track.setup();
+  board.power(ON, false);
+
+  setThrottleResponse throttle;
+  genericResponse response;
+  track.setThrottle(3, 0x80 | 20, throttle);
+  track.setThrottle(1234, 0x05, throttle);
+  track.setFunction(3, 0x10, response);
+  track.setFunction(1234, 0xDE, 0x81, response);
+  track.setAccessory(100, 2, true, response);
+
+  run(track, 300000);
+
+  TrackDecoderConfig decoderConfig = {
+    boardConfig.signal_a_pin, boardConfig.signal_b_pin, HIGH, 14
+  };
+  TrackDecoder decoder(decoderConfig);
+  decoder.decode(SimHardware::edges());
+  report(decoder);
+
+  check(decoder.violations().empty(), "no NMRA violations");
+  check(decoder.packets().size() > 20, "packets decoded");
+  check(decoder.cutouts() > 20, "cutouts generated");
+  check(decoder.contains({
+    {0x03, 0x3F, 0x94},
+    {0xC4, 0xD2, 0x3F, 0x05},
+    {0x03, 0x90},
+    {0xC4, 0xD2, 0xDE, 0x81},
+    {0xA4, 0xED},
+  }), "scheduled packets sent in order");
+  // Once the queue is empty the speed table is refreshed
+  check(decoder.contains({
+    {0x03, 0x3F, 0x94},
+    {0xC4, 0xD2, 0x3F, 0x05},
+    {0x03, 0x3F, 0x94},
+    {0xC4, 0xD2, 0x3F, 0x05},
+  }), "speed table refreshed");
+
+  // Let the first bandwidth window close
+  run(track, 1000000);
+  const BandwidthReport& bandwidth = track.getBandwidth();
+  uint32_t typeBits = 0;
+  for(uint8_t i = 0; i < kPacketTypes; i++) typeBits += bandwidth.byType[i].bits;
+  printf("  bandwidth: %u bits/s, first %u, repeat %u, refresh %u, idle %u packets/s\n",
+    bandwidth.totalBits, bandwidth.byClass[kTrafficFirst].packets, 
+    bandwidth.byClass[kTrafficRepeat].packets, 
+    bandwidth.byClass[kTrafficRefresh].packets, 
+    bandwidth.byClass[kTrafficIdle].packets);
+  check(bandwidth.windowMillis == kBandwidthWindow, "bandwidth window closed");
+  check(bandwidth.byClass[kTrafficFirst].packets == 5, "first transmissions counted");
+  check(bandwidth.byClass[kTrafficRepeat].packets == 9, "repeats counted");
+  check(bandwidth.byClass[kTrafficRefresh].packets > 0 
+    && bandwidth.byClass[kTrafficIdle].packets == 0, "refresh replaces idle");
+  // Every tick carries a bit, so the whole second is accounted for within 
+  // the packet that was in flight at either end of the window.
+  check(bandwidth.totalBits > 1000000 / 232 && bandwidth.totalBits < 1000000 / 116,
+    "bits per second within line rate");
+  check(typeBits == bandwidth.totalBits, "packet types add up to total");
+
+#if defined(DCC_LOOP_PROFILE)
+  check(LoopProfiler::getStats(kSectionMainTrack).time.count == 1300
+    && LoopProfiler::getStats(kSectionRailcom).time.count == 1300, 
+    "main track loop profiled");
+#endif
+
+#if defined(DCC_ISR_STATS)
+  const TimingHistogram& interrupt1 = track.isrStats.histograms[kIsrInterrupt1];
+  const TimingHistogram& interrupt2 = track.isrStats.histograms[kIsrInterrupt2];
+  check(interrupt1.count == 1300000 / kTickMicros + 1, "every interrupt1 timed");
+  check(interrupt2.count > 0 && interrupt2.count < interrupt1.count, 
+    "interrupt2 timed once per bit");
+  check(track.isrStats.histograms[kIsrLatency].max == 0, "timer never late");
+
+  // An interrupt1 running past the next compare match, which wraps TCNT1
+  IsrStats overrun = {};
+  OCR1A = 57;
+  TCNT1 = 10;
+  uint32_t start = isrStatsCounter();
+  TCNT1 = 5;
+  TIFR1 = _BV(OCF1A);
+  overrun.exit(kIsrInterrupt1, start);
+  TCNT1 = OCR1A = TIFR1 = 0;
+  check(overrun.histograms[kIsrInterrupt1].max == 58 + 5 - 10, 
+    "overrun timed across the counter wrap");
+#endif
+}
+
+void simulateService() {
+  printf("Programming track\n");
+  SimHardware::reset();
+
+  BoardConfigArduinoMotorShield boardConfig = {};
+  BoardArduinoMotorShield::getDefaultConfigB(boardConfig);
+  boardConfig.track_power_callback = trackPowerCallback;
+  static BoardArduinoMotorShield board(boardConfig);
+
+  static DCCService track(&board);
+  board.setup();
+  board.progMode(true);
+  track.setup();
+  board.power(ON, false);
+
+  // Nothing answers, so each write is sent and then fails verification. The
+  // jobs queued behind the first one run by priority, then in order.
+  serviceJobResponse first, second, cancelled, urgent;
+  track.writeCVByte(29, 0x06, 1, 2, &console, cvCallback, first);
+  track.writeCVByte(1, 0x03, 1, 2, &console, cvCallback, second);
+  track.writeCVByte(2, 0x04, 1, 2, &console, cvCallback, cancelled);
+  track.writeCVByte(3, 0x05, 1, 2, &console, cvCallback, urgent, 
+    kServicePriorityHigh);
+  check(first.position == 0 && second.position == 1 && urgent.position == 1,
+    "queue positions reported");
+  check(track.jobCount() == 4, "all jobs queued");
+  check(track.cancelJob(cancelled.jobID), "queued job cancelled");
+  check(!track.cancelJob(cancelled.jobID), "cancelled job is gone");
+
+  run(track, 2000000);
+
+  check(cvCallbackOrder == std::vector<uint16_t>({2, 29, 3, 1}),
+    "every job answered, by priority then in order");
+  check(track.jobCount() == 0, "job queue drained");
+
+  TrackDecoderConfig decoderConfig = {
+    boardConfig.signal_a_pin, 0xFF, HIGH, 20
+  };
+  TrackDecoder decoder(decoderConfig);
+  decoder.decode(SimHardware::edges());
+  report(decoder);
+
+  check(decoder.violations().empty(), "no NMRA violations");
+  check(decoder.cutouts() == 0, "no cutouts on the programming track");
+  check(decoder.contains({
+    {0x00, 0x00},
+    {0x7C, 0x1C, 0x06},
+    {0x74, 0x1C, 0x06},
+  }), "resets, write and verify sent");
+
+  // The running job and a full queue behind it
+  serviceJobResponse job;
+  for(uint8_t i = 0; i <= kServiceJobQueueSize; i++) 
+    track.writeCVByte(1, i, 1, 2, &console, cvCallback, job);
+  check(track.jobCount() == kServiceJobQueueSize + 1 && 
+    track.writeCVByte(1, 0, 1, 2, &console, cvCallback, job) == ERR_BUSY,
+    "job queue full");
+  while(track.jobCount() > 0) {
+    uint16_t jobID, cv;
+    track.getJob(0, jobID, cv);
+    track.cancelJob(jobID);
+  }
+}
+
+// Runs one service mode job to completion and returns its duration (micros)
+uint32_t runJob(DCCService& track, VirtualDecoder& decoder) {
+  uint32_t start = SimHardware::time();
+  lastCVValue = -2;
+  while(track.jobCount() > 0 && SimHardware::time() - start < 60000000) 
+    run(track, 1000, &decoder);
+  return lastCVTime - start;
+}
+
+// Reads the CVs a throttle needs to set up a loco and returns the time taken
+uint32_t onboard(DCCService& track, VirtualDecoder& decoder, CVCacheMode mode,
+  bool& correct) {
+  const uint16_t cvs[] = {1, 7, 8, 17, 18, 29};
+  uint32_t total = 0;
+  correct = true;
+  for(uint16_t cv : cvs) {
+    serviceJobResponse job;
+    track.readCV(cv, 0, 0, &console, cvCallback, job, kServicePriorityNormal, 
+      mode);
+    total += runJob(track, decoder);
+    if(lastCVValue != decoder.cv(cv)) correct = false;
+  }
+  return total;
+}
+
+void simulateServiceCache(DCCService& track, VirtualDecoder& decoder) {
+  printf("Programming track CV cache\n");
+  CVCache::clear();
+  decoder.cv(7) = 40;
+  decoder.cv(17) = 196;
+  decoder.cv(18) = 210;
+  track.selectCacheDecoder(151, 40, 1234);
+
+  bool correct;
+  uint32_t first = onboard(track, decoder, kCacheVerify, correct);
+  check(correct, "first onboarding read correctly");
+  check(CVCache::count(track.getCacheDecoder()) == 6, "CVs cached");
+
+  // As after a reboot, with another loco selected in between
+  track.selectCacheDecoder(1, 2, 3);
+  track.selectCacheDecoder(151, 40, 1234);
+  uint32_t verified = onboard(track, decoder, kCacheVerify, correct);
+  check(correct, "verified onboarding read correctly");
+  uint32_t eepromWrites = EEPROM.writes;
+  uint32_t trusted = onboard(track, decoder, kCacheTrust, correct);
+  check(correct, "trusted onboarding read correctly");
+  check(EEPROM.writes == eepromWrites, "unchanged values not rewritten");
+  printf("  onboarding: first %ums, verified %ums, trusted %ums\n", 
+    first / 1000, verified / 1000, trusted / 1000);
+  check(verified * 4 < first, "verifying the cache at least 4x faster");
+  check(trusted < 10000, "trusted reads don't use the track");
+
+  serviceJobResponse job;
+  track.writeCVByte(29, 38, 0, 0, &console, cvCallback, job);
+  runJob(track, decoder);
+  track.readCV(29, 0, 0, &console, cvCallback, job, kServicePriorityNormal, 
+    kCacheTrust);
+  runJob(track, decoder);
+  check(lastCVValue == 38, "byte write updates the cache");
+
+  track.writeCVBit(29, 0, 1, 0, 0, &console, cvCallback, job);
+  runJob(track, decoder);
+  uint8_t value;
+  check(!CVCache::lookup(track.getCacheDecoder(), 29, value), 
+    "bit write invalidates the cache");
+
+  decoder.cv(8) = 97;
+  track.readCV(8, 0, 0, &console, cvCallback, job);
+  runJob(track, decoder);
+  check(track.getCacheDecoder() == kCVCacheNoDecoder, 
+    "other manufacturer deselects the decoder");
+  track.selectCacheDecoder(151, 40, 1234);
+  check(CVCache::lookup(track.getCacheDecoder(), 8, value) && value == 151,
+    "old decoder's cache kept");
+
+  // No room for the cache, first on a small EEPROM and then with the EEStore
+  // data grown into it
+  EEPROM.setLength(512);
+  check(!CVCache::begin() && !CVCache::lookup(track.getCacheDecoder(), 8, value)
+    && CVCache::select(151, 40, 1234) == kCVCacheNoDecoder,
+    "cache disabled on a small EEPROM");
+  EEPROM.setLength(EEPROMClass::kSize);
+  int dataEnd = EEStore::pointer();
+  EEStore::eeAddress = EEPROMClass::kSize - 100;
+  check(!CVCache::begin(), "cache disabled under the EEStore data");
+  EEStore::eeAddress = dataEnd;
+  check(CVCache::lookup(track.getCacheDecoder(), 8, value) && value == 151,
+    "cache back once there is room");
+
+  // A decoder with more CVs than entries reuses its own
+  uint8_t other = CVCache::select(1, 2, 3);
+  CVCache::store(other, 1, 5);
+  for(uint16_t cv = 100; cv < 100 + 2 * kCVCacheDecoderEntries; cv++) 
+    CVCache::store(track.getCacheDecoder(), cv, cv);
+  check(CVCache::count(track.getCacheDecoder()) == kCVCacheDecoderEntries &&
+    CVCache::lookup(other, 1, value) && value == 5, 
+    "full decoder reuses its own entries");
+  uint32_t eepromReads = EEPROM.reads;
+  CVCache::lookup(track.getCacheDecoder(), 1, value);
+  check(EEPROM.reads - eepromReads <= 
+    kCVCacheDecoderEntries * sizeof(CVCacheEntry), 
+    "lookup reads only the decoder's entries");
+}
+
+void simulateServiceProfile(DCCService& track, VirtualDecoder& decoder) {
+  printf("Programming track decoder profile\n");
+  track.clearCacheDecoder();
+  track.clearSession();
+
+  // As many CVs as a session holds, of which the decoder already holds all
+  // but one in four
+  const uint8_t kProfileCVs = kSessionSize;
+  const uint8_t kChangedCVs = kProfileCVs / 4;
+  bool built = true;
+  for(uint16_t cv = 1; cv <= kProfileCVs; cv++) {
+    decoder.cv(cv + 100) = cv;
+    uint8_t value = (cv % 4 == 0) ? cv + 1 : cv;
+    if(!track.addSessionOp(kSessionWriteIfDifferent, cv + 100, value)) 
+      built = false;
+  }
+  check(built, "profile built");
+  check(!track.addSessionOp(kSessionWrite, 1, 1), "profile full");
+
+  serviceJobResponse job;
+  uint32_t writesBefore = decoder.writes();
+  check(track.runSession(0, 0, &console, cvCallback, job) == ERR_OK, 
+    "profile accepted");
+  check(!track.addSessionOp(kSessionWrite, 1, 1), "profile locked while applied");
+  uint32_t profileTime = runJob(track, decoder);
+
+  sessionStatusResponse status;
+  check(!track.getSessionStatus(status) && status.done == kProfileCVs &&
+    status.written == kChangedCVs && 
+    status.skipped == kProfileCVs - kChangedCVs && status.failed == 0,
+    "only changed CVs written");
+  check(decoder.writes() - writesBefore == kChangedCVs, 
+    "decoder saw only those writes");
+  bool applied = true;
+  for(uint16_t cv = 1; cv <= kProfileCVs; cv++) 
+    if(decoder.cv(cv + 100) != ((cv % 4 == 0) ? cv + 1 : cv)) applied = false;
+  check(applied, "profile applied");
+
+  // The same write done blindly, for comparison
+  track.writeCVByte(101, 1, 0, 0, &console, cvCallback, job);
+  uint32_t blindWrite = runJob(track, decoder);
+  track.writeCVByte(101, 1, 0, 0, &console, cvCallback, job, 
+    kServicePriorityNormal, true);
+  uint32_t skippedWrite = runJob(track, decoder);
+  check(lastCVValue == 0, "unchanged write skipped");
+  printf("  profile %ums, write %ums, skipped write %ums\n", 
+    profileTime / 1000, blindWrite / 1000, skippedWrite / 1000);
+  check(profileTime < blindWrite * kProfileCVs * 2 / 3, 
+    "profile faster than writing every CV");
+}
+
+void simulateServiceSession(DCCService& track, VirtualDecoder& decoder) {
+  printf("Programming track session\n");
+  track.clearSession();
+
+  // Fill the session with reads of some CVs and writes of as many others,
+  // first as separate jobs
+  const uint8_t kPairs = kSessionSize / 2;
+  serviceJobResponse job;
+  uint32_t separate = 0;
+  for(uint16_t cv = 200; cv < 200 + kPairs; cv++) {
+    decoder.cv(cv) = cv - 100;
+    track.readCV(cv, 0, 0, &console, cvCallback, job);
+    separate += runJob(track, decoder);
+    track.writeCVByte(cv + kPairs, cv, 0, 0, &console, cvCallback, job);
+    separate += runJob(track, decoder);
+  }
+
+  for(uint16_t cv = 200; cv < 200 + kPairs; cv++) {
+    track.addSessionOp(kSessionRead, cv);
+    track.addSessionOp(kSessionWrite, cv + kPairs, cv + 1);
+  }
+  cvCallbackOrder.clear();
+  check(track.runSession(0, 0, &console, cvCallback, job) == ERR_OK, 
+    "session accepted");
+  uint32_t batched = runJob(track, decoder);
+
+  sessionStatusResponse status;
+  track.getSessionStatus(status);
+  bool correct = status.done == kSessionSize && status.written == kPairs && 
+    status.failed == 0 && cvCallbackOrder.size() == kSessionSize;
+  for(uint16_t cv = 200; cv < 200 + kPairs; cv++) 
+    if(decoder.cv(cv + kPairs) != cv + 1) correct = false;
+  check(correct, "every operation done and reported");
+  printf("  separate jobs %ums, session %ums\n", separate / 1000, 
+    batched / 1000);
+  check(batched * 5 < separate * 4, "session at least 20% faster");
+
+  // Cancelling stops the session where it is
+  track.runSession(0, 0, &console, cvCallback, job);
+  run(track, 300000, &decoder);
+  check(track.cancelJob(job.jobID), "session cancelled");
+  check(!track.getSessionStatus(status) && status.done < kSessionSize && 
+    track.jobCount() == 0, "session stopped");
+}
+
+void simulateServiceAck(DCCService& track, VirtualDecoder& decoder) {
+  printf("Programming track ACK pulses\n");
+  serviceJobResponse job;
+  decoder.cv(5) = 200;
+  uint32_t blockingReads = SimHardware::analogReads();
+
+  decoder.setAck(60, 1000);
+  track.readCVPredicted(5, 200, 0, 0, &console, cvCallback, job);
+  runJob(track, decoder);
+  check(lastCVValue == -1, "1ms pulse rejected as noise");
+
+  decoder.setAck(60, 15000);
+  track.readCVPredicted(5, 200, 0, 0, &console, cvCallback, job);
+  runJob(track, decoder);
+  check(lastCVValue == -1, "15ms pulse rejected");
+
+  decoder.setAck(60, 3500);
+  track.readCVPredicted(5, 200, 0, 0, &console, cvCallback, job);
+  runJob(track, decoder);
+  check(lastCVValue == 200, "3.5ms pulse accepted");
+
+  decoder.setAck(60, 6000);
+  decoder.setLatency(2000);
+  decoder.setNoise(8);
+  track.readCV(5, 0, 0, &console, cvCallback, job);
+  runJob(track, decoder);
+  check(lastCVValue == 200, "late ACKs on a noisy track read");
+  decoder.setLatency(0);
+  decoder.setNoise(0);
+  check(SimHardware::analogReads() == blockingReads, 
+    "ACKs sampled without waiting for the ADC");
+
+  // A main loop stall that overflows the sample buffer before the ACK
+  uint32_t buffered = (uint32_t)kAckSampleBufferSize * kAckSampleMicros;
+  decoder.setLatency(buffered);
+  uint32_t writes = decoder.writes();
+  uint32_t acks = decoder.acks();
+  track.writeCVByte(5, 200, 0, 0, &console, cvCallback, job, 
+    kServicePriorityNormal, true);
+  while(decoder.acks() == acks) run(track, 1000, &decoder);
+  loopStall = buffered * 4;
+  runJob(track, decoder);
+  check(lastCVValue == 0 && decoder.writes() == writes, 
+    "lost samples not taken for a NACK");
+  decoder.setLatency(0);
+}
+
+void simulateServiceTiming(DCCService& track, VirtualDecoder& decoder) {
+  printf("Programming track timing\n");
+  serviceJobResponse job;
+  decoder.cv(29) = 34;
+  track.selectCacheDecoder(151, 41, 77);
+
+  // Bypass the cache so every read goes to the track
+  track.readCV(29, 0, 0, &console, cvCallback, job, kServicePriorityNormal, 
+    kCacheBypass);
+  uint32_t learning = runJob(track, decoder);
+  check(lastCVValue == 34, "read while learning");
+  CVCacheDecoder timing;
+  CVCache::getDecoder(track.getCacheDecoder(), timing);
+  check(timing.ackCount == kTimingObservations && timing.ackPackets == 2 &&
+    timing.ackResets == 0, "decoder timing learned");
+
+  track.readCV(29, 0, 0, &console, cvCallback, job, kServicePriorityNormal, 
+    kCacheBypass);
+  uint32_t learned = runJob(track, decoder);
+  check(lastCVValue == 34, "read with learned timing");
+  printf("  learning %ums, learned %ums\n", learning / 1000, learned / 1000);
+  check(learned * 3 < learning * 2, "learned timing at least 1.5x faster");
+
+  // A slower decoder with the same identity misses the short instructions
+  decoder.setResponsePackets(7);
+  track.readCV(29, 0, 0, &console, cvCallback, job, kServicePriorityNormal, 
+    kCacheBypass);
+  runJob(track, decoder);
+  check(lastCVValue == 34, "slow decoder read after falling back");
+  CVCache::getDecoder(track.getCacheDecoder(), timing);
+  check(timing.ackPackets == 7, "slow decoder timing relearned");
+  decoder.setResponsePackets(2);
+  track.clearCacheDecoder();
+}
+
+void simulateServiceIdentify(DCCService& track, VirtualDecoder& decoder) {
+  printf("Programming track identify\n");
+  track.clearCacheDecoder();
+  decoder.cv(8) = 151;
+  decoder.cv(7) = 52;
+  decoder.cv(29) = 34;    // Long address
+  decoder.cv(17) = 205;
+  decoder.cv(18) = 128;
+
+  // The reads a throttle does to identify a loco
+  serviceJobResponse job;
+  uint32_t separate = 0;
+  const uint16_t cvs[] = {8, 7, 29, 17, 18};
+  for(uint16_t cv : cvs) {
+    track.readCV(cv, 0, 0, &console, cvCallback, job);
+    separate += runJob(track, decoder);
+  }
+
+  check(track.identifyDecoder(1, 2, &console, identifyCallback, job) == ERR_OK,
+    "identify accepted");
+  check(track.identifyDecoder(1, 2, &console, identifyCallback, job) == 
+    ERR_BUSY, "one identify at a time");
+  uint32_t first = runJob(track, decoder);
+  check(lastIdentity.callback == 1 && lastIdentity.callbackSub == 2 &&
+    lastIdentity.address == 3456 && lastIdentity.manufacturer == 151 && 
+    lastIdentity.version == 52 && lastIdentity.config == 34, 
+    "long address decoder identified");
+  check(track.getCacheDecoder() != kCVCacheNoDecoder, 
+    "identified decoder selected");
+
+  track.identifyDecoder(1, 2, &console, identifyCallback, job);
+  uint32_t again = runJob(track, decoder);
+  check(lastIdentity.address == 3456, "identified again from the cache");
+  printf("  separate reads %ums, identify %ums, identify again %ums\n", 
+    separate / 1000, first / 1000, again / 1000);
+  check(first * 10 < separate * 9, "identify at least 10% faster");
+  check(again * 5 < separate, "identify again at least 5x faster");
+
+  // Same decoder model in another loco
+  decoder.cv(29) = 6;
+  decoder.cv(1) = 3;
+  track.identifyDecoder(1, 2, &console, identifyCallback, job);
+  runJob(track, decoder);
+  check(lastIdentity.address == 3 && lastIdentity.config == 6, 
+    "short address decoder identified");
+
+  track.clearCacheDecoder();
+  track.identifyDecoder(1, 2, &console, identifyCallback, job);
+  run(track, 300000, &decoder);
+  check(track.cancelJob(job.jobID) && lastIdentity.address == -1 && 
+    track.jobCount() == 0, "identify cancelled");
+  decoder.cv(29) = 34;
+  track.clearCacheDecoder();
+}
+
+// Checks the values in the backup frames against the decoder, and that they
+// cover CVs first to last in order.
+bool backupMatches(VirtualDecoder& decoder, uint16_t first, uint16_t last) {
+  uint16_t next = first;
+  for(const backupFrameResponse& frame : backupFrames) {
+    if(frame.firstCV != next) return false;
+    for(uint8_t i = 0; i < frame.count; i++) 
+      if(frame.values[i] != decoder.cv(next++)) return false;
+  }
+  return next == last + 1;
+}
+
+void simulateServiceBackup(DCCService& track, VirtualDecoder& decoder) {
+  printf("Programming track backup and restore\n");
+  track.clearCacheDecoder();
+  const uint16_t kFirst = 300;
+  const uint16_t kLast = 315;
+  for(uint16_t cv = kFirst; cv <= kLast; cv++) decoder.cv(cv) = cv * 7;
+
+  // A client reading one CV at a time
+  serviceJobResponse job;
+  uint32_t separate = 0;
+  for(uint16_t cv = kFirst; cv <= kLast; cv++) {
+    track.readCV(cv, 0, 0, &console, cvCallback, job);
+    separate += runJob(track, decoder);
+  }
+
+  backupFrames.clear();
+  check(track.backupCVs(kFirst, kLast, 0, 0, &console, backupCallback, job) == 
+    ERR_OK, "backup accepted");
+  uint32_t backup = runJob(track, decoder);
+  check(backupFrames.size() == 3 && backupFrames.back().count == 0 &&
+    backupFrames.back().firstCV == kLast + 1, "backup sent in frames");
+  backupFrames.pop_back();
+  check(backupMatches(decoder, kFirst, kLast), "backup matches the decoder");
+  printf("  separate reads %ums, backup %ums\n", separate / 1000, 
+    backup / 1000);
+  check(backup * 10 < separate * 9, "backup at least 10% faster");
+
+  // Interrupted, then resumed from where it stopped
+  backupFrames.clear();
+  track.backupCVs(kFirst, kLast, 0, 0, &console, backupCallback, job);
+  run(track, 5000000, &decoder);
+  check(track.cancelJob(job.jobID), "backup cancelled");
+  uint16_t resume = backupFrames.back().firstCV;
+  backupFrames.pop_back();
+  check(resume > kFirst && resume <= kLast, "cancelled backup can resume");
+  track.backupCVs(resume, kLast, 0, 0, &console, backupCallback, job);
+  runJob(track, decoder);
+  backupFrames.pop_back();
+  check(backupMatches(decoder, kFirst, kLast), "resumed backup complete");
+
+  // Restore the image after three CVs were changed, in two parts 
+  uint8_t image[kLast - kFirst + 1];
+  for(uint16_t cv = kFirst; cv <= kLast; cv++) image[cv - kFirst] = 
+    decoder.cv(cv);
+  decoder.cv(kFirst) = 1;
+  decoder.cv(kFirst + 7) = 2;
+  decoder.cv(kLast) = 3;
+
+  uint32_t writesBefore = decoder.writes();
+  cvCallbackOrder.clear();
+  check(track.restoreCVs(0, 0, &console, cvCallback, job) == ERR_OK, 
+    "restore accepted");
+  bool added = true;
+  for(uint16_t cv = kFirst; cv < kFirst + 8; cv++) 
+    added = added && track.addRestoreCV(cv, image[cv - kFirst]);
+  run(track, 1000000, &decoder);
+  for(uint16_t cv = kFirst + 8; cv <= kLast; cv++) 
+    added = added && track.addRestoreCV(cv, image[cv - kFirst]);
+  check(added, "image added while restoring");
+  run(track, 1000000, &decoder);
+  check(track.jobCount() == 1, "restore waits for the end of the image");
+  track.endRestore();
+  runJob(track, decoder);
+
+  restoreStatusResponse status;
+  check(!track.getRestoreStatus(status) && status.done == 16 && 
+    status.written == 3 && status.skipped == 13 && status.failed == 0 &&
+    !status.timedOut && cvCallbackOrder.size() == 16, 
+    "only changed CVs written");
+  check(decoder.writes() - writesBefore == 3, "decoder saw 3 writes");
+  bool restored = true;
+  for(uint16_t cv = kFirst; cv <= kLast; cv++) 
+    if(decoder.cv(cv) != image[cv - kFirst]) restored = false;
+  check(restored, "image restored");
+
+  track.restoreCVs(0, 0, &console, cvCallback, job);
+  check(track.cancelJob(job.jobID) && track.jobCount() == 0, 
+    "waiting restore cancelled");
+
+  // A client that goes away without ending the image
+  track.restoreCVs(0, 0, &console, cvCallback, job);
+  track.addRestoreCV(kFirst, image[0]);
+  run(track, (kRestoreIdleMillis - 1000) * 1000UL, &decoder);
+  check(track.jobCount() == 1, "idle restore waits");
+  run(track, 2000000, &decoder);
+  check(track.jobCount() == 0 && !track.getRestoreStatus(status) && 
+    status.done == 1 && status.timedOut, "idle restore timed out");
+}
+
+void simulateServiceReads() {
+  printf("Programming track reads\n");
+  SimHardware::reset();
+
+  BoardConfigArduinoMotorShield boardConfig = {};
+  BoardArduinoMotorShield::getDefaultConfigB(boardConfig);
+  boardConfig.track_power_callback = trackPowerCallback;
+  static BoardArduinoMotorShield board(boardConfig);
+
+  static DCCService track(&board);
+  board.setup();
+  board.progMode(true);
+  track.setup();
+  board.power(ON, false);
+
+  VirtualDecoderConfig decoderConfig = {
+    boardConfig.signal_a_pin, boardConfig.sense_pin,
+    boardConfig.board_voltage * 1000 * boardConfig.amps_per_volt / 1023,
+    10, 60, 6000
+  };
+  VirtualDecoder decoder(decoderConfig);
+  decoder.cv(1) = 3;
+  decoder.cv(8) = 151;
+  decoder.cv(29) = 34;
+
+  serviceJobResponse job;
+  track.readCV(8, 0, 0, &console, cvCallback, job);
+  uint32_t fullRead = runJob(track, decoder);
+  check(lastCVValue == 151, "full read");
+
+  track.readCVPredicted(8, 151, 0, 0, &console, cvCallback, job);
+  uint32_t predictedRead = runJob(track, decoder);
+  check(lastCVValue == 151, "predicted read");
+
+  track.readCV(1, 0, 0, &console, cvCallback, job);
+  uint32_t defaultRead = runJob(track, decoder);
+  check(lastCVValue == 3, "read predicted from common defaults");
+
+  track.readCVPredicted(29, 6, 0, 0, &console, cvCallback, job);
+  uint32_t missedRead = runJob(track, decoder);
+  check(lastCVValue == 34, "wrong prediction falls back to a full read");
+
+  printf("  full %ums, predicted %ums, default %ums, missed %ums\n", 
+    fullRead / 1000, predictedRead / 1000, defaultRead / 1000, 
+    missedRead / 1000);
+  check(predictedRead * 5 < fullRead, "predicted read at least 5x faster");
+  check(defaultRead * 5 < fullRead, "default read at least 5x faster");
+  check(missedRead < fullRead * 5 / 4, "missed prediction costs one verify");
+
+  simulateServiceCache(track, decoder);
+  simulateServiceProfile(track, decoder);
+  simulateServiceSession(track, decoder);
+  simulateServiceAck(track, decoder);
+  simulateServiceTiming(track, decoder);
+  simulateServiceIdentify(track, decoder);
+  simulateServiceBackup(track, decoder);
+}
+
+void simulateCurrentSampler() {
+  printf("Current sampler\n");
+  SimHardware::reset();
+  SimHardware::setAnalog(A0, 300);
+  SimHardware::setAnalog(A1, 700);
+
+  // Both boards' sense pins were added by the earlier simulations
+  uint8_t main = CurrentSampler::addPin(A0);
+  uint8_t prog = CurrentSampler::addPin(A1);
+  check(main != kCurrentSamplerNoChannel && prog != kCurrentSamplerNoChannel &&
+    main != prog, "one channel per sense pin");
+  // A board whose pin didn't get a channel still drives its signal
+  check(!CurrentSampler::reversed(kCurrentSamplerNoChannel) &&
+    CurrentSampler::latest(kCurrentSamplerNoChannel) == 0, 
+    "no channel reads as idle");
+
+  uint32_t start = CurrentSampler::conversions();
+  advanceSampled(100000);
+  uint32_t conversions = CurrentSampler::conversions() - start;
+  check(CurrentSampler::latest(main) == 300 && 
+    CurrentSampler::latest(prog) == 700, "latest samples of each pin");
+  uint16_t samples[kCurrentSamplerDepth];
+  uint8_t count = CurrentSampler::recent(prog, samples, kCurrentSamplerDepth);
+  bool recent = count == kCurrentSamplerDepth - 1;
+  for(uint8_t i = 0; i < count; i++) if(samples[i] != 700) recent = false;
+  check(recent, "recent samples kept");
+
+  printf("  %u conversions in 100ms, %u samples/s per pin\n", conversions, 
+    conversions * 10 / 2);
+  uint32_t expected = 100000 / (kCurrentSamplerTicks * kTickMicros);
+  check(conversions + 1 >= expected && conversions <= expected + 1, 
+    "one conversion every kCurrentSamplerTicks ticks");
+
+  // An analogRead elsewhere, first while the ADC is idle. Its result must 
+  // not be taken for a sample.
+  SimHardware::advance(kTickMicros);
+  SimHardware::setAnalog(A2, 1000);
+  ADMUX = _BV(REFS0) | 2;
+  ADCSRA |= _BV(ADSC);
+  SimHardware::advance(kTickMicros);
+  check(CurrentSampler::latest(main) == 300 && 
+    CurrentSampler::latest(prog) == 700, "stray conversion dropped");
+
+  // Then leaving the ADC disabled, as analogRead does on SAMD
+  ADCSRA = 0;
+  SimHardware::setAnalog(A0, 400);
+  advanceSampled(10000);
+  check(CurrentSampler::latest(main) == 400, "sampler recovers the ADC");
+  SimHardware::setAnalog(A0, 0);
+  SimHardware::setAnalog(A1, 0);
+}
+
+// Checks a board's integer current conversion against the floating point 
+// formula it replaced, then overloads it
+template<class BoardType, class ConfigType>
+void simulateCurrentPipeline(const char* name) {
+  printf("%s current pipeline\n", name);
+  SimHardware::reset();
+  ConfigType config = {};
+  BoardType::getDefaultConfigA(config);
+  config.track_power_callback = trackPowerCallback;
+  BoardType board(config);
+  board.setup();
+  board.progMode(false);
+
+  float worst = 0;
+  for(uint16_t counts = 0; counts <= 1023; counts++) {
+    float milliamps = counts / 1023.0 * config.board_voltage * 1000 * 
+      config.amps_per_volt;
+    worst = fmax(worst, fabs(board.getCurrentMilliamps(counts) - milliamps));
+  }
+  printf("  worst conversion error %.2fmA\n", worst);
+  check(worst <= 0.51, "conversion within half a milliamp");
+
+  // A sustained overload trips on the I2t curve after n samples
+  float milliampsPerCount = config.board_voltage * 1000 * 
+    config.amps_per_volt / 1023;
+  uint32_t tripCounts = config.current_trip / milliampsPerCount;
+  // Lets the board recover from an earlier trip, then makes sure it is on
+  auto recoverBoard = [&]() {
+    SimHardware::setAnalog(config.sense_pin, 0);
+    while(board.isTripped()) {
+      board.checkOverload();
+      advanceSampled(100);
+    }
+    board.power(ON, false);
+  };
+  auto overloadFor = [&](uint16_t counts, uint32_t micros) {
+    recoverBoard();
+    SimHardware::setAnalog(config.sense_pin, counts);
+    uint32_t start = SimHardware::time();
+    while(board.getStatus() && SimHardware::time() - start < micros) {
+      board.checkOverload();
+      advanceSampled(100);
+    }
+    SimHardware::setAnalog(config.sense_pin, 0);
+    return (SimHardware::time() - start) / 1000;
+  };
+  boardTripEvent event;
+  uint16_t trips = board.getLastTrip(event);
+  uint16_t counts = tripCounts * 3 / 2;
+  uint32_t samples = ceil((float)kOverloadSamples * tripCounts * tripCounts / 
+    ((float)counts * counts - tripCounts * tripCounts));
+  uint32_t tripMillis = overloadFor(counts, 2000000);
+  // checkOverload samples every other millisecond
+  printf("  1.5x trip current trips after %ums, %u samples expected\n", 
+    tripMillis, samples);
+  check(!board.getStatus() && tripMillis + 2 >= 2 * samples && 
+    tripMillis <= 2 * samples + 2, "overload trips on the I2t curve");
+  check(board.getLastTrip(event) == trips + 1 && 
+    event.kind == kTripOverload, "overload trip recorded");
+
+  uint32_t smallMillis = overloadFor(tripCounts * 6 / 5, 2000000);
+  uint32_t largeMillis = overloadFor(tripCounts * 9 / 5, 2000000);
+  printf("  1.2x trips after %ums, 1.8x after %ums\n", smallMillis, 
+    largeMillis);
+  check(largeMillis * 4 < smallMillis, "larger overloads trip sooner");
+  overloadFor(tripCounts * 9 / 5, 10000);
+  check(board.getStatus(), "short overload rides through");
+
+  // A dead short, cut by the sampler without checkOverload running
+  trips = board.getLastTrip(event);
+  recoverBoard();
+  uint32_t shortStart = SimHardware::time();
+  SimHardware::setAnalog(config.sense_pin, 1023);
+  while(board.getStatus() && SimHardware::time() - shortStart < 10000) 
+    advanceSampled(1);
+  uint32_t cutMicros = SimHardware::time() - shortStart;
+  printf("  short circuit cut after %uus\n", cutMicros);
+  check(!board.getStatus() && cutMicros <= kShortCutMicros, 
+    "short circuit cut by the sampler");
+  board.checkOverload();
+  check(board.getLastTrip(event) == trips + 1 && event.kind == kTripFast &&
+    event.time - shortStart <= cutMicros && 
+    event.milliamps == board.getCurrentMilliamps(1023), 
+    "short circuit trip recorded");
+  SimHardware::setAnalog(config.sense_pin, 0);
+
+  // A small overload, which the old average truncated to nothing
+  recoverBoard();
+  board.setTripCurrents(5 * milliampsPerCount, config.current_trip_prog);
+  SimHardware::setAnalog(config.sense_pin, 8);
+  for(uint32_t i = 0; i < 20000 && board.getStatus(); i++) {
+    board.checkOverload();
+    advanceSampled(100);
+  }
+  check(!board.getStatus(), "small overload trips");
+  board.setTripCurrents(config.current_trip, config.current_trip_prog);
+  recoverBoard();
+}
+
+// Windows and history of a current that steps up
+void simulateCurrentTelemetry() {
+  printf("Current telemetry\n");
+  SimHardware::reset();
+  BoardConfigArduinoMotorShield config = {};
+  BoardArduinoMotorShield::getDefaultConfigA(config);
+  config.track_power_callback = trackPowerCallback;
+  BoardArduinoMotorShield board(config);
+  board.setup();
+  board.progMode(false);
+  board.power(ON, false);
+
+  auto runUntil = [&](uint32_t millis) {
+    while(SimHardware::time() < millis * 1000) {
+      board.checkOverload();
+      advanceSampled(100);
+    }
+  };
+  uint16_t low = board.getCurrentMilliamps(100);
+  uint16_t high = board.getCurrentMilliamps(300);
+
+  // Let the sampler see the current before the first sample is taken
+  SimHardware::setAnalog(config.sense_pin, 100);
+  advanceSampled(1000);
+  runUntil(5000);
+  SimHardware::setAnalog(config.sense_pin, 300);
+  runUntil(10500);
+  CurrentWindowStats second = board.getCurrentWindow(kWindowSecond);
+  CurrentWindowStats ten = board.getCurrentWindow(kWindowTenSeconds);
+  printf("  1s %u/%u/%umA, 10s %u/%u/%umA\n", second.min, second.mean, 
+    second.max, ten.min, ten.mean, ten.max);
+  check(second.min == high && second.mean == high && second.max == high, 
+    "last second");
+  check(ten.min == low && ten.max == high && 
+    abs(ten.mean - (low + high) / 2) <= (low + high) / 100, 
+    "last ten seconds");
+
+  uint16_t history[kTelemetrySeconds];
+  uint8_t kept = board.getCurrentHistory(history);
+  check(kept == kTelemetrySeconds && history[0] == low && 
+    history[kept - 1] == high, "history oldest first");
+
+  runUntil(40500);
+  check(board.getCurrentWindow(kWindowMinute).min == low, 
+    "minute holds the step");
+  runUntil(72500);
+  CurrentWindowStats minute = board.getCurrentWindow(kWindowMinute);
+  check(minute.min == high && minute.mean == high, "minute slides past it");
+}
+
+// A train crossing into a reversing section shorts it for a moment
+void simulateAutoReverser() {
+  printf("Auto reverser\n");
+  SimHardware::reset();
+
+  BoardConfigArduinoMotorShield boardConfig = {};
+  BoardArduinoMotorShield::getDefaultConfigA(boardConfig);
+  boardConfig.track_power_callback = trackPowerCallback;
+  boardConfig.reverser = true;
+  static BoardArduinoMotorShield board(boardConfig);
+
+  RailComConfig railcomConfig = {};
+  Railcom::getDefaultConfig(railcomConfig);
+  railcomConfig.enable = false;
+  railcomConfig.serial = &railcomSerial;
+  static Railcom railcom(railcomConfig);
+
+  static DCCMain track(10, &board, &railcom);
+  board.setup();
+  track.setup();
+  board.power(ON, false);
+
+  setThrottleResponse throttle;
+  track.setThrottle(3, 0x80 | 20, throttle);
+  run(track, 100000);
+
+  uint16_t flips = board.getPolarityFlips();
+  SimHardware::setAnalog(boardConfig.sense_pin, 1023);
+  uint32_t shortStart = SimHardware::time();
+  while(board.getPolarityFlips() == flips && 
+    SimHardware::time() - shortStart < 10000) 
+    run(track, kTickMicros);
+  uint32_t flipMicros = SimHardware::time() - shortStart;
+  SimHardware::setAnalog(boardConfig.sense_pin, 0);
+  printf("  polarity flipped after %uus\n", flipMicros);
+  check(board.getPolarityFlips() == flips + 1 && flipMicros <= kShortCutMicros,
+    "polarity flipped by the sampler");
+  check(board.getStatus() && !board.isTripped(), "power stays on");
+
+  run(track, 200000);
+  // The decoder takes the signal pin's view, which is the other rail's from 
+  // the flip on
+  std::vector<SimEdge> edges = SimHardware::edges();
+  uint32_t flipTime = shortStart + flipMicros;
+  for(SimEdge& edge : edges) 
+    if(edge.pin == boardConfig.signal_a_pin && edge.time >= flipTime) 
+      edge.level = !edge.level;
+  TrackDecoderConfig decoderConfig = {
+    boardConfig.signal_a_pin, 0xFF, HIGH, 14
+  };
+  TrackDecoder decoder(decoderConfig);
+  decoder.decode(edges);
+  uint32_t before = 0, after = 0;
+  for(const DecodedPacket& packet : decoder.packets()) {
+    if(packet.time < shortStart) before++;
+    else if(packet.time > shortStart + 1000) after++;
+  }
+  bool onlyAtFlip = true;
+  for(const Violation& violation : decoder.violations()) 
+    if(violation.time < shortStart || violation.time > shortStart + 2000) 
+      onlyAtFlip = false;
+  printf("  %u packets in 100ms before the flip, %u in 200ms after, "
+    "%zu violations\n", before, after, decoder.violations().size());
+  check(after + 2 >= 2 * before, "packets keep flowing");
+  check(onlyAtFlip, "waveform only disturbed at the flip");
+
+  // A short that is still there after flipping is a real one
+  boardTripEvent trip;
+  uint16_t trips = board.getLastTrip(trip);
+  SimHardware::setAnalog(boardConfig.sense_pin, 1023);
+  run(track, 10000);
+  SimHardware::setAnalog(boardConfig.sense_pin, 0);
+  check(!board.getStatus() && board.getPolarityFlips() == flips + 2 &&
+    board.getLastTrip(trip) == trips + 1 && trip.kind == kTripFast, 
+    "persistent short cut after one flip");
+}
+
+// Current drawn by each simulated board, only while its enable pin is high
+uint16_t budgetCounts[2];
+uint8_t budgetEnablePins[2];
+
+uint16_t budgetAnalog(uint8_t pin) {
+  uint8_t board = pin == A0 ? 0 : 1;
+  return SimHardware::level(budgetEnablePins[board]) ? budgetCounts[board] : 0;
+}
+
+// Two boards on one supply, the second one shed first
+void simulatePowerBudget() {
+  printf("Power budget\n");
+  SimHardware::reset();
+  powerOns = powerOffs = 0;
+
+  BoardConfigArduinoMotorShield configA = {}, configB = {};
+  BoardArduinoMotorShield::getDefaultConfigA(configA);
+  BoardArduinoMotorShield::getDefaultConfigB(configB);
+  configA.track_power_callback = configB.track_power_callback = 
+    countPowerCallback;
+  static BoardArduinoMotorShield boardA(configA), boardB(configB);
+  boardA.setup();
+  boardB.setup();
+  budgetEnablePins[0] = configA.enable_pin;
+  budgetEnablePins[1] = configB.enable_pin;
+  budgetCounts[0] = budgetCounts[1] = 0;
+  SimHardware::setAnalogSource(budgetAnalog);
+  PowerBudget::addBoard(&boardB, 1);
+  PowerBudget::addBoard(&boardA, 0);
+
+  auto runFor = [&](uint32_t millis) {
+    uint32_t end = SimHardware::time() + millis * 1000;
+    while(SimHardware::time() < end) {
+      boardA.checkOverload();
+      boardB.checkOverload();
+      PowerBudget::loop();
+      advanceSampled(100);
+    }
+  };
+
+  PowerBudget::powerAll(true);
+  check(boardA.getStatus() && !boardB.getStatus(), 
+    "highest priority board on first");
+  runFor(kPowerStaggerTime - 10);
+  check(!boardB.getStatus(), "second board waits");
+  runFor(20);
+  check(boardB.getStatus(), "second board on after the stagger time");
+
+  // 1200mA each against a 2000mA supply
+  uint16_t counts = 1200 / (configA.board_voltage * 1000 * 
+    configA.amps_per_volt / 1023);
+  PowerBudget::setLimit(2000);
+  budgetCounts[0] = budgetCounts[1] = counts;
+  uint32_t start = SimHardware::time();
+  while(boardB.getStatus() && SimHardware::time() - start < 5000000) 
+    runFor(1);
+  printf("  total %umA, second board shed after %ums\n", 
+    PowerBudget::getTotal(), (SimHardware::time() - start) / 1000);
+  check(!boardB.getStatus() && boardA.getStatus() && 
+    PowerBudget::getShed() == 2, "lowest priority board shed");
+  check(powerOffs == 1, "shedding announced");
+  runFor(kPowerRestoreDelay + 1000);
+  check(!boardB.getStatus(), "stays shed while it would not fit");
+
+  budgetCounts[0] = counts / 3;
+  runFor(kPowerRestoreDelay + 1000);
+  check(boardB.getStatus() && PowerBudget::getShed() == 0 && powerOns == 1, 
+    "restored once it fits");
+  runFor(2000);
+  check(boardB.getStatus(), "not shed again");
+
+  // A trip followed by turning the power off must not recover by itself
+  PowerBudget::setLimit(0);
+  budgetCounts[0] = 1023;
+  runFor(50);
+  check(boardA.isTripped() && !boardA.getStatus(), "first board tripped");
+  PowerBudget::powerAll(false);
+  budgetCounts[0] = budgetCounts[1] = 0;
+  runFor(kRecoveryFirstDelay * 4);
+  check(!boardA.getStatus() && !boardB.getStatus(), 
+    "no recovery once the power is off");
+  PowerBudget::powerAll(true);
+  runFor(kPowerStaggerTime * 2);
+  check(boardA.getStatus() && boardB.getStatus() && !boardA.isTripped(), 
+    "power on clears the trip");
+
+  PowerBudget::powerAll(false);
+  PowerBudget::setLimit(0);
+  PowerBudget::removeBoard(&boardA);
+  PowerBudget::removeBoard(&boardB);
+  check(!PowerBudget::hasBoard(&boardA) && !PowerBudget::hasBoard(&boardB),
+    "boards removed");
+
+  // The Pololu shield's channels share an enable pin
+  BoardConfigPololuMotorShield pololuConfigA = {}, pololuConfigB = {};
+  BoardPololuMotorShield::getDefaultConfigA(pololuConfigA);
+  BoardPololuMotorShield::getDefaultConfigB(pololuConfigB);
+  BoardPololuMotorShield pololuA(pololuConfigA), pololuB(pololuConfigB);
+  check(PowerBudget::addBoard(&pololuA, 0) && 
+    !PowerBudget::addBoard(&pololuB, 1), "shared enable pin refused");
+  PowerBudget::removeBoard(&pololuA);
+  SimHardware::setAnalogSource(nullptr);
+}
+
+// Command framing of the serial interfaces
+void simulateLineAssembler() {
+  printf("Line assembler\n");
+  LineAssembler lines;
+  std::vector<std::string> frames;
+  auto feed = [&](const std::string& input) {
+    for(char ch : input) 
+      if(lines.add(ch)) frames.push_back(lines.line());
+  };
+
+  feed("noise<t 1 3 20 1>\r\n<1><s");
+  feed(">");
+  check(frames.size() == 3 && frames[0] == "t 1 3 20 1" && frames[1] == "1" &&
+    frames[2] == "s", "commands framed across reads");
+
+  // A new command before the last one ended
+  feed("<R 1 2<0>");
+  check(frames.size() == 4 && frames[3] == "0" && 
+    lines.getStats().dropped == 1, "unfinished command dropped");
+
+  std::string longest(kLineCapacity, '9');
+  std::string tooLong(kLineCapacity + 10, '9');
+  feed("<" + longest + ">");
+  check(frames.size() == 5 && frames[4] == longest, "longest command kept");
+  feed("<" + tooLong + "><1>");
+  check(frames.size() == 6 && frames[5] == "1" && 
+    lines.getStats().oversized == 1, "oversized command discarded");
+  lines.setOverflow(kLineTruncate);
+  feed("<" + tooLong + ">");
+  check(frames.size() == 7 && frames[6] == longest && 
+    lines.getStats().oversized == 2, "oversized command truncated");
+  check(lines.getStats().frames == 7, "frames counted");
+}
+
+// A derailment that clears, then a short that stays
+void simulateOverloadRecovery() {
+  printf("Overload recovery\n");
+  SimHardware::reset();
+  BoardConfigArduinoMotorShield config = {};
+  BoardArduinoMotorShield::getDefaultConfigA(config);
+  config.track_power_callback = countPowerCallback;
+  BoardArduinoMotorShield board(config);
+  board.setup();
+  board.progMode(false);
+  board.power(ON, false);
+  powerOns = powerOffs = 0;
+
+  // Runs the board for a while, returning the time the power was on (micros)
+  auto run = [&](uint32_t micros, bool untilRecovered) {
+    uint32_t start = SimHardware::time();
+    uint32_t on = 0;
+    while(SimHardware::time() - start < micros && 
+      !(untilRecovered && !board.isTripped())) {
+      board.checkOverload();
+      if(board.getStatus()) on += 10;
+      advanceSampled(10);
+    }
+    return on;
+  };
+
+  SimHardware::setAnalog(config.sense_pin, 1023);
+  run(50000, false);
+  SimHardware::setAnalog(config.sense_pin, 0);
+  uint32_t start = SimHardware::time();
+  run(kRecoveryMaxDelay * 1000, true);
+  uint32_t recoverMillis = (SimHardware::time() - start) / 1000;
+  printf("  derailment cleared, power back after %ums\n", recoverMillis);
+  check(board.getStatus() && recoverMillis < 1000, 
+    "derailment recovers within a second");
+  check(powerOffs == 1 && powerOns == 1, "trip and recovery announced");
+
+  // Stay up long enough to start again from the first delay
+  run(kRecoveryStableTime * 1000, false);
+  uint16_t probes = board.getFailedProbes();
+  SimHardware::setAnalog(config.sense_pin, 1023);
+  uint32_t on = run(60000000, false);
+  probes = board.getFailedProbes() - probes;
+  printf("  persistent short: %u probes in 60s, %uus of fault current\n", 
+    probes, on);
+  check(probes >= 4 && probes <= 9, "probes back off");
+  check(on <= probes * kShortCutMicros, 
+    "persistent short is not powered for long");
+  check(powerOffs == 2 && powerOns == 1, "probes are not announced");
+
+  SimHardware::setAnalog(config.sense_pin, 0);
+  start = SimHardware::time();
+  run(kRecoveryMaxDelay * 1000 + 1000000, true);
+  check(board.getStatus() && !board.isTripped() && powerOns == 2, 
+    "recovers once the short is cleared");
+}
+
+// Sends a command through the serial interface and returns the replies
+std::string command(const std::string& text) {
+  Serial.receive(text);
+  CommManager::update();
+  return Serial.takeOutput();
+}
+
+bool contains(const std::string& text, const std::string& part) {
+  return text.find(part) != std::string::npos;
+}
+
+// Number of replies starting with prefix
+uint32_t countReplies(const std::string& text, const std::string& prefix) {
+  uint32_t count = 0;
+  for(size_t at = text.find(prefix); at != std::string::npos;
+    at = text.find(prefix, at + 1)) count++;
+  return count;
+}
+
+// Both tracks and the command station's loop as the sketch runs them, with a
+// service mode decoder on the programming track
+struct Station {
+  DCCMain& main;
+  DCCService& prog;
+  VirtualDecoder& decoder;
+
+  // Runs for at most micros and returns the replies sent meanwhile. Stops
+  // early once one containing until has been sent.
+  std::string run(uint32_t micros, const char* until = nullptr) {
+    std::string output;
+    uint32_t end = SimHardware::time() + micros;
+    uint32_t nextLoop = SimHardware::time();
+    while(SimHardware::time() < end) {
+      if(main.interrupt1()) main.interrupt2();
+      if(prog.interrupt1()) prog.interrupt2();
+      decoder.update();
+      if(SimHardware::time() >= nextLoop) {
+        main.loop();
+        prog.loop();
+        PowerBudget::loop();
+        CommManager::update();
+        nextLoop += 1000;
+        output += Serial.takeOutput();
+        if(until != nullptr && contains(output, until)) break;
+      }
+      SimHardware::advance(kTickMicros);
+    }
+    return output;
+  }
+};
+
+// Every command added to the parser, sent through a serial interface
+void simulateParser() {
+  printf("Command parser\n");
+  SimHardware::reset();
+
+  BoardConfigArduinoMotorShield mainConfig = {}, progConfig = {};
+  BoardArduinoMotorShield::getDefaultConfigA(mainConfig);
+  BoardArduinoMotorShield::getDefaultConfigB(progConfig);
+  mainConfig.track_power_callback = progConfig.track_power_callback =
+    DCCEXParser::trackPowerCallback;
+  static BoardArduinoMotorShield mainBoard(mainConfig), progBoard(progConfig);
+
+  RailComConfig railcomConfig = {};
+  Railcom::getDefaultConfig(railcomConfig);
+  railcomConfig.enable = false;
+  railcomConfig.serial = &railcomSerial;
+  static Railcom railcom(railcomConfig);
+
+  static DCCMain main(10, &mainBoard, &railcom);
+  static DCCService prog(&progBoard);
+  mainBoard.setup();
+  progBoard.setup();
+  progBoard.progMode(true);
+  main.setup();
+  prog.setup();
+  mainBoard.power(ON, false);
+  progBoard.power(ON, false);
+
+  VirtualDecoderConfig decoderConfig = {
+    progConfig.signal_a_pin, progConfig.sense_pin,
+    progConfig.board_voltage * 1000 * progConfig.amps_per_volt / 1023,
+    10, 60, 6000
+  };
+  VirtualDecoder decoder(decoderConfig);
+  decoder.cv(1) = 3;
+  decoder.cv(7) = 52;
+  decoder.cv(8) = 151;
+  decoder.cv(29) = 6;
+
+  // As the sketch does in setup
+  PowerBudget::addBoard(&mainBoard, 0);
+  PowerBudget::addBoard(&progBoard, 1);
+  DCCEXParser::init(&main, &prog);
+  static SerialInterface serial(Serial);
+  CommManager::registerInterface(&serial);
+  Station station = {main, prog, decoder};
+  std::string sent;
+  auto send = [&](const std::string& text) {
+    sent += text;
+    return command(text);
+  };
+  Serial.takeOutput();
+
+  // Reports
+  station.run(1100000);
+  std::string reply = send("<U>");
+  check(contains(reply, "<u 1000 ") && countReplies(reply, "<u c ") == 4 &&
+    contains(reply, "<u t "), "<U> bandwidth report");
+
+  reply = send("<L>");
+#if defined(DCC_ISR_STATS)
+  check(countReplies(reply, "<l A ") == 2 * kIsrStatsKinds &&
+    countReplies(reply, "<l B ") == 2 * kIsrStatsKinds, "<L> ISR timing");
+  check(send("<L 0>") == "<O>", "<L 0> resets ISR timing");
+#else
+  check(reply == "<X>", "<L> without ISR timing built in");
+#endif
+
+#if defined(DCC_LOOP_PROFILE)
+  check(send("<G 1 500>") == "<O>" && send("<G 9 1>") == "<X>",
+    "<G SECTION BUDGET> sets budgets");
+  reply = send("<G>");
+  int section, budget;
+  check(countReplies(reply, "<g ") == kLoopSections + 1 &&
+    sscanf(reply.c_str() + reply.find("<g 1 "), "<g %d %*d %*d %*d %*d %d",
+    &section, &budget) == 2 && section == 1 && budget == 500,
+    "<G> loop profile");
+  check(send("<G 0>") == "<O>", "<G 0> resets the profile");
+#else
+  check(send("<G>") == "<X>", "<G> without the loop profiler built in");
+#endif
+
+  // Programming track jobs
+  check(send("<K 0>") == "<O>", "<K 0> clears the CV cache");
+  EEPROM.setLength(512);
+  check(send("<K 151 52 3>") == "<X>", "<K> without room for the cache");
+  EEPROM.setLength(EEPROMClass::kSize);
+  reply = send("<K 151 52 3>");
+  int slot, cached;
+  check(sscanf(reply.c_str(), "<o %d %d>", &slot, &cached) == 2 &&
+    slot == prog.getCacheDecoder() && cached == 0, "<K> selects a decoder");
+  check(send("<K>") == "<O>" && prog.getCacheDecoder() == kCVCacheNoDecoder,
+    "<K> deselects it");
+
+  check(send("<R 8 1 2 151>") == "<j 1 0>", "<R PREDICTED> queued");
+  check(contains(station.run(5000000, "<r1|2|8 "), "<r1|2|8 151>"),
+    "<R PREDICTED> read");
+  check(send("<W 29 6 1 3 1>") == "<j 2 0>", "<W IFDIFFERENT> queued");
+  check(contains(station.run(5000000, "<r1|3|29 "), "<r1|3|29 0>"),
+    "<W IFDIFFERENT> skips an unchanged CV");
+
+  check(send("<R 1 11 12>") == "<j 3 0>" && send("<R 8 11 13>") == "<j 4 1>",
+    "reads queued behind each other");
+  check(send("<J>") == "<j 3 0 1><j 4 1 8>", "<J> lists the jobs");
+  check(send("<J 4>") == "<r11|13|8 -1><O>" && send("<J 4>") == "<X>",
+    "<J JOBID> cancels a job");
+  check(contains(station.run(5000000, "<r11|12|1 "), "<r11|12|1 3>"),
+    "job ahead of it still runs");
+
+  check(send("<P 0>") == "<O>" && send("<P 3 8 7>") == "<y 2 0 0 0 0>" &&
+    send("<P 4 40 9>") == "<y 3 0 0 0 0>", "<P> builds a session");
+  check(send("<P 1 5 6>") == "<j 5 0>", "<P 1> runs it");
+  reply = station.run(10000000, "<r5|6|40 ");
+  check(contains(reply, "<r5|6|8 151>") && contains(reply, "<r5|6|7 52>") &&
+    contains(reply, "<r5|6|40 1>") && decoder.cv(40) == 9,
+    "session operations reported");
+  check(send("<P>") == "<y 3 3 1 0 0>", "<P> session status");
+
+  check(send("<I 1 2>") == "<j 6 0>", "<I> queued");
+  check(contains(station.run(10000000, "<d1|2 "), "<d1|2 3 151 52 6>"),
+    "<I> identifies the decoder");
+
+  decoder.cv(300) = 11;
+  decoder.cv(301) = 22;
+  decoder.cv(302) = 33;
+  check(send("<V 300 302 3 4>") == "<j 7 0>", "<V> queued");
+  reply = station.run(10000000, "<v3|4 303>");
+  check(contains(reply, "<v3|4 300 11 22 33>") && contains(reply, "<v3|4 303>"),
+    "<V> backs up CVs");
+
+  check(send("<D 1 7 8>") == "<j 8 0>", "<D 1> starts a restore");
+  check(send("<D 2 300 11 301 99>") == "<z 2 0 0 0 0 0>", "<D 2> adds CVs");
+  check(send("<D 0>") == "<z 2 0 0 0 0 0>", "<D 0> ends the image");
+  reply = station.run(10000000, "<r7|8|301 ");
+  check(contains(reply, "<r7|8|300 0>") && contains(reply, "<r7|8|301 1>") &&
+    decoder.cv(301) == 99, "restore written");
+  check(send("<D>") == "<z 0 2 1 1 0 0>", "<D> restore status");
+
+  // Power and current
+  reply = send("<C>");
+  check(reply.compare(0, 5, "<x A ") == 0 && contains(reply, " B ") &&
+    countReplies(reply, " ") == 2 * (3 * kCurrentWindows + 4),
+    "<C> current telemetry");
+  reply = send("<C -1>");
+  check(reply.compare(0, 5, "<h A ") == 0 && contains(reply, " B "),
+    "<C -1> current history");
+  check(send("<C 50>") == "<X>" && send("<C 100>") == "<O>",
+    "<C PERIOD> subscribes");
+  check(countReplies(station.run(250000), "<x A ") == 2,
+    "telemetry pushed every period");
+  check(send("<C 0>") == "<O>" && countReplies(station.run(250000), "<x ") == 0,
+    "<C 0> unsubscribes");
+
+  check(send("<M 2000>") == "<O>" && send("<M -1>") == "<X>" && 
+    send("<M 65536>") == "<X>", "<M LIMIT> sets the budget");
+  reply = send("<M>");
+  long total, limit;
+  int shed, pending;
+  check(sscanf(reply.c_str(), "<m %ld %ld %d %d>", &total, &limit, &shed,
+    &pending) == 4 && limit == 2000 && shed == 0 && pending == 0,
+    "<M> power budget");
+  check(send("<M 65535>") == "<O>" && PowerBudget::getLimit() == 65535,
+    "<M> takes the largest limit");
+  send("<M 0>");
+  check(contains(send("<0>"), "<p0>") && !mainBoard.getStatus() && 
+    !progBoard.getStatus(), "<0> turns the power off");
+  send("<1>");
+  check(mainBoard.getStatus() && !progBoard.getStatus(), 
+    "<1> powers the main track first");
+  station.run(kPowerStaggerTime * 2000);
+  check(progBoard.getStatus(), "then the programming track");
+
+  // Input statistics, including the command asking for them
+  std::string tooLong = "<" + std::string(kLineCapacity + 1, '9') + ">";
+  check(send(tooLong) == "", "oversized command ignored");
+  sent += "<n>";
+  uint32_t frames = countReplies(sent, "<") - 1;
+  reply = command("<n>");
+  char expected[48];
+  snprintf(expected, sizeof(expected), "<n 0 %u %u 1 0>",
+    (unsigned)sent.size(), (unsigned)frames);
+  check(reply == expected, "<n> command input statistics");
+}
+
+// Time spent in the ISR entry points for every simulated tick and bit. Only
+// useful relative to other builds of the same code on the same host.
+void benchmark() {
+  printf("ISR benchmark\n");
+  SimHardware::reset();
+
+  BoardConfigArduinoMotorShield boardConfig = {};
+  BoardArduinoMotorShield::getDefaultConfigA(boardConfig);
+  boardConfig.track_power_callback = trackPowerCallback;
+  static BoardArduinoMotorShield board(boardConfig);
+
+  RailComConfig railcomConfig = {};
+  Railcom::getDefaultConfig(railcomConfig);
+  railcomConfig.enable = true;
+  railcomConfig.serial = &railcomSerial;
+  static Railcom railcom(railcomConfig);
+
+  static DCCMain track(10, &board, &railcom);
+  board.setup();
+  board.power(ON, false);
+
+  // The simulated ADC would be timed along with the ISRs
+  uint8_t adc = ADCSRA;
+  ADCSRA &= ~_BV(ADEN);
+
+  const uint32_t kTicks = 2000000;
+  uint32_t bits = 0;
+  auto start = std::chrono::steady_clock::now();
+  for(uint32_t i = 0; i < kTicks; i++) {
+    if(track.interrupt1()) {
+      track.interrupt2();
+      bits++;
+    }
+    SimHardware::advance(kTickMicros);
+    // Keep the edge log from growing without bound
+    if((i & 0xFFFF) == 0) SimHardware::clearEdges();
+  }
+  auto end = std::chrono::steady_clock::now();
+  double ns = std::chrono::duration<double, std::nano>(end - start).count();
+
+  printf("  %u ticks, %u bits: %.1f ns/tick, %.1f ns/bit\n", kTicks, bits, 
+    ns / kTicks, ns / bits);
+  ADCSRA = adc;
+}
+
+// Track time taken by each kind of service mode job against decoders that
+// answer at different speeds, for measuring changes to the ACK manager. Host
+// time is the time taken to simulate them.
+void benchmarkService() {
+  printf("Programming track benchmark\n");
+  SimHardware::reset();
+
+  BoardConfigArduinoMotorShield boardConfig = {};
+  BoardArduinoMotorShield::getDefaultConfigB(boardConfig);
+  boardConfig.track_power_callback = trackPowerCallback;
+  static BoardArduinoMotorShield board(boardConfig);
+
+  static DCCService track(&board);
+  board.setup();
+  board.progMode(true);
+  track.setup();
+  board.power(ON, false);
+
+  VirtualDecoderConfig decoderConfig = {
+    boardConfig.signal_a_pin, boardConfig.sense_pin,
+    boardConfig.board_voltage * 1000 * boardConfig.amps_per_volt / 1023,
+    10, 60, 6000
+  };
+  VirtualDecoder decoder(decoderConfig);
+
+  struct DecoderModel {
+    const char* name;
+    uint8_t responsePackets;
+    uint32_t latency;
+    uint16_t noise;
+  };
+  const DecoderModel models[] = {
+    {"fast", 2, 0, 0},
+    {"slow", 5, 4000, 0},
+    {"noisy", 2, 0, 8},
+  };
+
+  cvCallbackVerbose = false;
+  printf("  %-8s %9s %9s %9s %9s %9s\n", "decoder", "read", "predicted", 
+    "write", "bit", "host");
+  for(const DecoderModel& model : models) {
+    decoder.setResponsePackets(model.responsePackets);
+    decoder.setLatency(model.latency);
+    decoder.setNoise(model.noise);
+    decoder.cv(3) = 0x5A;
+    decoder.cv(29) = 6;
+
+    serviceJobResponse job;
+    bool correct = true;
+    auto start = std::chrono::steady_clock::now();
+    track.readCV(3, 0, 0, &console, cvCallback, job);
+    uint32_t read = runJob(track, decoder);
+    if(lastCVValue != 0x5A) correct = false;
+    track.readCVPredicted(3, 0x5A, 0, 0, &console, cvCallback, job);
+    uint32_t predicted = runJob(track, decoder);
+    if(lastCVValue != 0x5A) correct = false;
+    track.writeCVByte(4, 0x33, 0, 0, &console, cvCallback, job);
+    uint32_t write = runJob(track, decoder);
+    if(lastCVValue != 1 || decoder.cv(4) != 0x33) correct = false;
+    track.writeCVBit(29, 5, 1, 0, 0, &console, cvCallback, job);
+    uint32_t bit = runJob(track, decoder);
+    if(lastCVValue != 1 || decoder.cv(29) != 0x26) correct = false;
+    auto end = std::chrono::steady_clock::now();
+    double ms = std::chrono::duration<double, std::milli>(end - start).count();
+
+    printf("  %-8s %7ums %7ums %7ums %7ums %7.0fms\n", model.name, 
+      read / 1000, predicted / 1000, write / 1000, bit / 1000, ms);
+    check(correct, "every job answered correctly");
+  }
+  cvCallbackVerbose = true;
+}
+
+int main(int argc, char* argv[]) {
+  bool bench = argc > 1 && strcmp(argv[1], "--bench") == 0;
+
+  simulateMain();
+  simulateService();
+  simulateServiceReads();
+  simulateCurrentSampler();
+  simulateCurrentPipeline<BoardArduinoMotorShield, 
+    BoardConfigArduinoMotorShield>("Arduino motor shield");
+  simulateCurrentPipeline<BoardPololuMotorShield, 
+    BoardConfigPololuMotorShield>("Pololu motor shield");
+  simulateCurrentTelemetry();
+  simulateAutoReverser();
+  simulatePowerBudget();
+  simulateLineAssembler();
+  simulateOverloadRecovery();
+  simulateParser();
+  if(bench) {
+    benchmark();
+    benchmarkService();
+  }
+
+  printf(failures ? "%d check(s) failed\n" : "all checks passed\n", failures);
+  return failures ? 1 : 0;
+}
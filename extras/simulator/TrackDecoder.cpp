@@ -0,0 +1,207 @@
+/*
+ *  TrackDecoder.cpp
+ * 
+ *  This file is part of CommandStation.
+ *
+ *  CommandStation is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  CommandStation is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with CommandStation.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include "TrackDecoder.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+
+void TrackDecoder::fail(uint32_t time, const char* rule, const char* format, ...) {
+  char detail[96];
+  va_list args;
+  va_start(args, format);
+  vsnprintf(detail, sizeof(detail), format, args);
+  va_end(args);
+
+  Violation violation;
+  violation.time = time;
+  violation.rule = rule;
+  violation.detail = detail;
+  violationLog.push_back(violation);
+}
+
+void TrackDecoder::decode(const std::vector<SimEdge>& edges) {
+  struct Interval { uint32_t start; uint32_t end; };
+  std::vector<uint32_t> rises;
+  std::vector<uint32_t> falls;
+  std::vector<Interval> cutoutLog;
+
+  for(const SimEdge& edge : edges) {
+    if(edge.pin == config.signal_pin) {
+      if(edge.level == HIGH) rises.push_back(edge.time);
+      else falls.push_back(edge.time);
+    }
+    else if(edge.pin == config.cutout_pin) {
+      if(edge.level == config.cutout_level) {
+        Interval cutout = {edge.time, 0};
+        cutoutLog.push_back(cutout);
+      }
+      else if(!cutoutLog.empty() && cutoutLog.back().end == 0) {
+        cutoutLog.back().end = edge.time;
+      }
+    }
+  }
+
+  packetLog.clear();
+  violationLog.clear();
+  oneCount = zeroCount = cutoutCount = 0;
+
+  State state = kSeekPreamble;
+  DecodedPacket packet = {};
+  uint8_t preambles = 0;
+  uint8_t bitCount = 0;
+  bool afterEnd = false;    // Previous bit was a packet end bit
+  bool sawCutout = false;
+  size_t fall = 0;
+  size_t cutout = 0;
+
+  // Each bit runs from one rising edge to the next; the last rise is ignored
+  // since we can't tell how long it lasts.
+  for(size_t i = 0; i + 1 < rises.size(); i++) {
+    uint32_t rise = rises[i];
+    uint32_t nextRise = rises[i + 1];
+
+    while(fall < falls.size() && falls[fall] <= rise) fall++;
+    if(fall >= falls.size() || falls[fall] >= nextRise) {
+      fail(rise, "bit", "no falling edge between %u and %u", rise, nextRise);
+      state = kSeekPreamble;
+      continue;
+    }
+    uint32_t high = falls[fall] - rise;
+    uint32_t low = nextRise - falls[fall];
+
+    while(cutout < cutoutLog.size() && cutoutLog[cutout].start < rise) cutout++;
+    if(cutout < cutoutLog.size() && cutoutLog[cutout].start < nextRise) {
+      // Railcom cutout in place of a preamble bit
+      const Interval& c = cutoutLog[cutout];
+      uint32_t startOffset = c.start - rise;
+      uint32_t endOffset = c.end - rise;
+      cutoutCount++;
+
+      if(state != kSeekPreamble && !afterEnd)
+        fail(rise, "cutout", "cutout does not follow a packet end bit");
+      if(startOffset < kCutoutStartMin || startOffset > kCutoutStartMax)
+        fail(rise, "cutout", "starts %uus after end bit (%u-%u)", startOffset, 
+          kCutoutStartMin, kCutoutStartMax);
+      if(c.end == 0 || endOffset < kCutoutEndMin || endOffset > kCutoutEndMax)
+        fail(rise, "cutout", "ends %uus after end bit (%u-%u)", endOffset, 
+          kCutoutEndMin, kCutoutEndMax);
+
+      // The cutout stands in for as many one bits as fit in it
+      preambles += (nextRise - rise) / (2 * kOneHalfMax);
+      sawCutout = true;
+      afterEnd = false;
+      if(state == kSeekPreamble) state = kPreamble;
+      continue;
+    }
+    afterEnd = false;
+
+    bool bit;
+    if(high >= kOneHalfMin && high <= kOneHalfMax && low >= kOneHalfMin 
+        && low <= kOneHalfMax) {
+      uint32_t skew = high > low ? high - low : low - high;
+      if(skew > kOneHalfSkew) 
+        fail(rise, "one bit", "halves differ by %uus", skew);
+      bit = true;
+      oneCount++;
+    }
+    else if(high >= kZeroHalfMin && high <= kZeroHalfMax && low >= kZeroHalfMin 
+        && low <= kZeroHalfMax && high + low <= kZeroBitMax) {
+      bit = false;
+      zeroCount++;
+    }
+    else {
+      fail(rise, "bit", "halves of %uus/%uus are neither a one nor a zero", 
+        high, low);
+      state = kSeekPreamble;
+      preambles = 0;
+      continue;
+    }
+
+    switch(state) {
+    case kSeekPreamble:
+    case kPreamble:
+      if(bit) {
+        preambles++;
+        break;
+      }
+      // Start bit. Before the first packet we may have joined mid-preamble.
+      if(state == kPreamble && preambles < config.min_preambles)
+        fail(rise, "preamble", "%u preamble bits, need %u", preambles, 
+          config.min_preambles);
+      if(state == kPreamble || preambles >= config.min_preambles) {
+        packet = DecodedPacket();
+        packet.time = rise;
+        packet.preambles = preambles;
+        packet.cutout = sawCutout;
+        packet.bytes[0] = 0;
+        bitCount = 0;
+        state = kData;
+      }
+      preambles = 0;
+      sawCutout = false;
+      break;
+    case kData:
+      packet.bytes[packet.length] = (packet.bytes[packet.length] << 1) | bit;
+      if(++bitCount == 8) {
+        packet.length++;
+        state = kSeparator;
+      }
+      break;
+    case kSeparator:
+      if(!bit) {
+        if(packet.length >= sizeof(packet.bytes)) {
+          fail(rise, "packet", "longer than %u bytes", (unsigned)sizeof(packet.bytes));
+          state = kSeekPreamble;
+          break;
+        }
+        packet.bytes[packet.length] = 0;
+        bitCount = 0;
+        state = kData;
+        break;
+      }
+      // Packet end bit
+      {
+        uint8_t checksum = 0;
+        for(uint8_t b = 0; b < packet.length; b++) checksum ^= packet.bytes[b];
+        if(packet.length < 3) 
+          fail(packet.time, "packet", "only %u bytes", packet.length);
+        else if(checksum != 0) 
+          fail(packet.time, "checksum", "error byte does not match (xor %02x)", checksum);
+        packetLog.push_back(packet);
+      }
+      afterEnd = true;
+      preambles = 0;
+      state = kPreamble;
+      break;
+    }
+  }
+}
+
+bool TrackDecoder::contains(const std::vector<std::vector<uint8_t>>& expected) const {
+  size_t next = 0;
+  for(const DecodedPacket& packet : packetLog) {
+    if(next == expected.size()) break;
+    const std::vector<uint8_t>& want = expected[next];
+    if(packet.length != want.size() + 1) continue;
+    if(memcmp(packet.bytes, want.data(), want.size()) == 0) next++;
+  }
+  return next == expected.size();
+}
@@ -0,0 +1,97 @@
+/*
+ *  TrackDecoder.h
+ * 
+ *  This file is part of CommandStation.
+ *
+ *  CommandStation is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  CommandStation is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with CommandStation.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef COMMANDSTATION_SIMULATOR_TRACKDECODER_H_
+#define COMMANDSTATION_SIMULATOR_TRACKDECODER_H_
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "SimHardware.h"
+
+// Limits from NMRA S-9.1 (command station side) and S-9.3.2 (railcom cutout),
+// in microseconds.
+const uint32_t kOneHalfMin = 55;
+const uint32_t kOneHalfMax = 61;
+const uint32_t kOneHalfSkew = 3;    // Max difference between the two halves
+const uint32_t kZeroHalfMin = 95;
+const uint32_t kZeroHalfMax = 9900;
+const uint32_t kZeroBitMax = 12000;
+const uint32_t kCutoutStartMin = 26;
+const uint32_t kCutoutStartMax = 32;
+const uint32_t kCutoutEndMin = 454;
+const uint32_t kCutoutEndMax = 488;
+
+struct DecodedPacket {
+  uint32_t time;        // Rising edge of the start bit
+  uint8_t bytes[8];     // Including the checksum byte
+  uint8_t length;
+  uint8_t preambles;    // One bits (or their equivalent in cutout) before it
+  bool cutout;          // A railcom cutout preceded this packet
+};
+
+struct Violation {
+  uint32_t time;
+  std::string rule;
+  std::string detail;
+};
+
+struct TrackDecoderConfig {
+  uint8_t signal_pin;
+  uint8_t cutout_pin;       // 0xFF if the track has no cutout
+  uint8_t cutout_level;     // Level of cutout_pin while in the cutout
+  uint8_t min_preambles;    // 14 on the main track, 20 in service mode
+};
+
+// Turns the recorded edges of one track back into bits and packets and checks
+// them against the NMRA timing rules.
+class TrackDecoder {
+public:
+  TrackDecoder(TrackDecoderConfig config) : config(config) {}
+
+  void decode(const std::vector<SimEdge>& edges);
+
+  const std::vector<DecodedPacket>& packets() const { return packetLog; }
+  const std::vector<Violation>& violations() const { return violationLog; }
+
+  uint32_t ones() const { return oneCount; }
+  uint32_t zeros() const { return zeroCount; }
+  uint32_t cutouts() const { return cutoutCount; }
+
+  // Checks that `expected` appears, in order, among the non-idle packets.
+  // Packets are given without their checksum byte.
+  bool contains(const std::vector<std::vector<uint8_t>>& expected) const;
+
+private:
+  TrackDecoderConfig config;
+  std::vector<DecodedPacket> packetLog;
+  std::vector<Violation> violationLog;
+  uint32_t oneCount = 0;
+  uint32_t zeroCount = 0;
+  uint32_t cutoutCount = 0;
+
+  enum State { kSeekPreamble, kPreamble, kData, kSeparator };
+
+  void fail(uint32_t time, const char* rule, const char* format, ...);
+};
+
+#endif  // COMMANDSTATION_SIMULATOR_TRACKDECODER_H_
@@ -0,0 +1,178 @@
+/*
+ *  VirtualDecoder.cpp
+ * 
+ *  This file is part of CommandStation.
+ *
+ *  CommandStation is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  CommandStation is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with CommandStation.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include "VirtualDecoder.h"
+
+#include <string.h>
+
+// Longest first half of a one bit, anything longer is a zero
+const uint32_t kOneHalfLimit = 80;
+// One bits needed before a start bit is accepted
+const uint8_t kPreambleMin = 10;
+
+VirtualDecoder* VirtualDecoder::active = nullptr;
+
+VirtualDecoder::VirtualDecoder(VirtualDecoderConfig config) : config(config) {
+  memset(cvs, 0, sizeof(cvs));
+  edgeIndex = SimHardware::edges().size();
+  active = this;
+  SimHardware::setAnalogSource(senseSource);
+}
+
+VirtualDecoder::~VirtualDecoder() {
+  if(active != this) return;
+  active = nullptr;
+  SimHardware::setAnalogSource(nullptr);
+}
+
+uint16_t VirtualDecoder::senseSource(uint8_t pin) {
+  if(active == nullptr || pin != active->config.sense_pin) return 0;
+  int32_t milliamps = active->config.idle_milliamps;
+  uint32_t now = SimHardware::time();
+  if(now >= active->ackStart && now < active->ackEnd) 
+    milliamps += active->config.ack_milliamps;
+  if(active->noise > 0) {
+    // Numerical Recipes LCG, good enough for noise
+    active->noiseState = active->noiseState * 1664525 + 1013904223;
+    milliamps += (int32_t)((active->noiseState >> 16) % 
+      (2 * active->noise + 1)) - active->noise;
+  }
+  if(milliamps < 0) milliamps = 0;
+  uint32_t counts = milliamps / active->config.milliamps_per_count + 0.5;
+  return counts > 1023 ? 1023 : counts;
+}
+
+void VirtualDecoder::update() {
+  const std::vector<SimEdge>& edges = SimHardware::edges();
+  // The log may have been cleared since the last call
+  if(edgeIndex > edges.size()) edgeIndex = 0;
+
+  for(; edgeIndex < edges.size(); edgeIndex++) {
+    const SimEdge& edge = edges[edgeIndex];
+    if(edge.pin != config.signal_pin) continue;
+    if(edge.level == LOW) {
+      lastFall = edge.time;
+      continue;
+    }
+    // A rising edge ends the previous bit
+    if(haveRise && lastFall > lastRise) 
+      bit(lastFall - lastRise < kOneHalfLimit ? 1 : 0);
+    lastRise = edge.time;
+    haveRise = true;
+  }
+}
+
+void VirtualDecoder::bit(uint8_t value) {
+  switch(state) {
+  case kPreamble:
+    if(value) {
+      if(preambles < 255) preambles++;
+    }
+    else {
+      if(preambles >= kPreambleMin) {
+        state = kData;
+        length = 0;
+        bitCount = 0;
+        packet[0] = 0;
+      }
+      preambles = 0;
+    }
+    break;
+  case kData:
+    packet[length] = (packet[length] << 1) | value;
+    if(++bitCount == 8) {
+      length++;
+      state = kSeparator;
+    }
+    break;
+  case kSeparator:
+    if(value) {
+      receive();
+      state = kPreamble;
+      preambles = 1;    // The end bit counts towards the next preamble
+    }
+    else if(length == sizeof(packet)) {
+      state = kPreamble;
+    }
+    else {
+      state = kData;
+      bitCount = 0;
+      packet[length] = 0;
+    }
+    break;
+  }
+}
+
+void VirtualDecoder::receive() {
+  uint8_t check = 0;
+  for(uint8_t i = 0; i < length; i++) check ^= packet[i];
+  if(check != 0) return;
+
+  if(length == lastLength && memcmp(packet, lastPacket, length) == 0) {
+    if(repeats < 255 && ++repeats == responsePackets) execute();
+    return;
+  }
+
+  memcpy(lastPacket, packet, length);
+  lastLength = length;
+  repeats = 1;
+  if(responsePackets <= 1) execute();
+}
+
+void VirtualDecoder::execute() {
+  // Direct mode: 0111CCAA AAAAAAAA DDDDDDDD EEEEEEEE
+  if(length != 4 || (packet[0] & 0xF0) != 0x70) return;
+
+  uint16_t number = (((packet[0] & 0x03) << 8) | packet[1]) + 1;
+  uint8_t data = packet[2];
+  uint8_t& value = cv(number);
+
+  switch((packet[0] >> 2) & 0x03) {
+  case 0x01:    // Verify byte
+    if(value == data) ack();
+    break;
+  case 0x03:    // Write byte
+    value = data;
+    writeCount++;
+    ack();
+    break;
+  case 0x02: {  // Bit manipulation: 111KDBBB
+    if((data & 0xE0) != 0xE0) break;
+    uint8_t mask = 1 << (data & 0x07);
+    bool bitValue = data & 0x08;
+    if(data & 0x10) {
+      if(bitValue) value |= mask;
+      else value &= ~mask;
+      writeCount++;
+      ack();
+    }
+    else if(((value & mask) != 0) == bitValue) {
+      ack();
+    }
+    break;
+  }
+  }
+}
+
+void VirtualDecoder::ack() {
+  ackStart = SimHardware::time() + latency;
+  ackEnd = ackStart + config.ack_micros;
+  ackCount++;
+}
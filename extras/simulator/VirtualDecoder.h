@@ -0,0 +1,115 @@
+/*
+ *  VirtualDecoder.h
+ * 
+ *  This file is part of CommandStation.
+ *
+ *  CommandStation is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  CommandStation is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with CommandStation.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef COMMANDSTATION_SIMULATOR_VIRTUALDECODER_H_
+#define COMMANDSTATION_SIMULATOR_VIRTUALDECODER_H_
+
+#include <stdint.h>
+
+#include "SimHardware.h"
+
+struct VirtualDecoderConfig {
+  uint8_t signal_pin;
+  uint8_t sense_pin;
+  float milliamps_per_count;  // Current sense scaling of the board
+  uint16_t idle_milliamps;    // Current drawn when not acknowledging
+  uint16_t ack_milliamps;     // Extra current drawn during an ACK
+  uint32_t ack_micros;        // Length of the ACK pulse
+};
+
+// A service mode decoder on the programming track. It decodes the track signal
+// as it is generated, holds a CV memory and answers direct mode verify and
+// write instructions with an ACK current pulse on the board's sense pin.
+class VirtualDecoder {
+public:
+  static const uint16_t kCVs = 1024;
+
+  VirtualDecoder(VirtualDecoderConfig config);
+  ~VirtualDecoder();
+
+  uint8_t& cv(uint16_t number) { return cvs[number - 1]; }
+
+  // Changes the ACK pulse, to model decoders that don't meet S-9.2.3
+  void setAck(uint16_t milliamps, uint32_t micros) {
+    config.ack_milliamps = milliamps;
+    config.ack_micros = micros;
+  }
+
+  // Delay between an instruction taking effect and the start of the ACK
+  void setLatency(uint32_t micros) { latency = micros; }
+
+  // Adds random noise of up to +/- milliamps to every current reading. The
+  // same seed gives the same noise on every run.
+  void setNoise(uint16_t milliamps, uint32_t seed = 1) {
+    noise = milliamps;
+    noiseState = seed;
+  }
+
+  // Number of identical packets needed before an instruction is carried out,
+  // to model slower decoders
+  void setResponsePackets(uint8_t packets) { responsePackets = packets; }
+
+  // Consumes the track edges recorded since the last call
+  void update();
+
+  uint32_t acks() const { return ackCount; }
+  uint32_t writes() const { return writeCount; }
+
+private:
+  VirtualDecoderConfig config;
+  uint8_t cvs[kCVs];
+  size_t edgeIndex = 0;
+  uint32_t lastRise = 0;
+  uint32_t lastFall = 0;
+  bool haveRise = false;
+
+  enum State { kPreamble, kData, kSeparator };
+  State state = kPreamble;
+  uint8_t preambles = 0;
+  uint8_t bitCount = 0;
+  uint8_t packet[6];
+  uint8_t length = 0;
+
+  // Service mode instructions take effect on the second identical packet,
+  // unless set otherwise
+  uint8_t lastPacket[6];
+  uint8_t lastLength = 0;
+  uint8_t repeats = 0;
+  uint8_t responsePackets = 2;
+
+  uint32_t latency = 0;
+  uint16_t noise = 0;
+  uint32_t noiseState = 1;
+
+  uint32_t ackStart = 0;
+  uint32_t ackEnd = 0;
+  uint32_t ackCount = 0;
+  uint32_t writeCount = 0;
+
+  static VirtualDecoder* active;
+  static uint16_t senseSource(uint8_t pin);
+
+  void bit(uint8_t value);
+  void receive();
+  void execute();
+  void ack();
+};
+
+#endif  // COMMANDSTATION_SIMULATOR_VIRTUALDECODER_H_
@@ -0,0 +1,153 @@
+/*
+ *  Arduino.h
+ * 
+ *  This file is part of CommandStation.
+ *
+ *  CommandStation is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  CommandStation is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with CommandStation.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Minimal stand-in for the Arduino core so the DCC code can be built on the
+// host. Pins, the ADC and time are provided by SimHardware.cpp.
+
+#ifndef COMMANDSTATION_SIMULATOR_SHIM_ARDUINO_H_
+#define COMMANDSTATION_SIMULATOR_SHIM_ARDUINO_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HIGH 0x1
+#define LOW  0x0
+
+#define INPUT 0x0
+#define OUTPUT 0x1
+#define INPUT_PULLUP 0x2
+
+// Analog pins as numbered on a Mega
+#define A0 54
+#define A1 55
+#define A2 56
+#define A3 57
+
+#define DEC 10
+#define HEX 16
+#define OCT 8
+#define BIN 2
+
+#define PROGMEM
+#define pgm_read_byte_near(address) (*(const uint8_t*)(address))
+#define pgm_read_byte(address) (*(const uint8_t*)(address))
+#define pgm_read_word_near(address) (*(const uint16_t*)(address))
+
+#define highByte(w) ((uint8_t)((w) >> 8))
+#define lowByte(w) ((uint8_t)((w) & 0xff))
+#define bitRead(value, bit) (((value) >> (bit)) & 0x01)
+
+#define B11111000 0xF8
+
+#define _BV(bit) (1 << (bit))
+
+// ADC registers, as on a Mega. SimHardware runs a conversion whenever ADSC is
+// set and calls the ADC_vect handler at the end if ADIE is set.
+extern volatile uint8_t ADCSRA;
+extern volatile uint8_t ADCSRB;
+extern volatile uint8_t ADMUX;
+extern volatile uint16_t ADC;
+#define ADPS0 0
+#define ADPS1 1
+#define ADPS2 2
+#define ADIE 3
+#define ADSC 6
+#define ADEN 7
+#define MUX5 3
+#define REFS0 6
+
+#define ISR(vector) void vector()
+#define ADC_vect simAdcVector
+void simAdcVector();
+// Waveform timer count, compare value and flags. The simulated timer fires
+// exactly on time, so these stay at zero unless a check sets them.
+extern volatile uint16_t TCNT1;
+extern volatile uint16_t OCR1A;
+extern volatile uint8_t TIFR1;
+#define OCF1A 1
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t val);
+int digitalRead(uint8_t pin);
+int analogRead(uint8_t pin);
+unsigned long millis();
+unsigned long micros();
+
+inline void noInterrupts() {}
+inline void interrupts() {}
+
+class __FlashStringHelper;
+#define F(string_literal) (reinterpret_cast<const __FlashStringHelper *>(string_literal))
+
+class Print {
+public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t c) = 0;
+  size_t print(const char* s) { size_t n = 0; while(*s) n += write(*s++); return n; }
+  size_t print(const __FlashStringHelper* s) { return print((const char*)s); }
+  size_t print(char c) { return write(c); }
+  size_t print(long n, int base = DEC) { 
+    char buf[34];
+    if(base == DEC) snprintf(buf, sizeof(buf), "%ld", n);
+    else if(base == HEX) snprintf(buf, sizeof(buf), "%lX", n);
+    else if(base == OCT) snprintf(buf, sizeof(buf), "%lo", n);
+    else {
+      int i = 33; 
+      unsigned long v = n;
+      buf[i] = '\0';
+      do { buf[--i] = '0' + (v & 1); v >>= 1; } while(v);
+      return print(buf + i);
+    }
+    return print(buf);
+  }
+  size_t print(int n, int base = DEC) { return print((long)n, base); }
+  size_t print(double n, int digits = 2) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%.*f", digits, n);
+    return print(buf);
+  }
+};
+
+class Stream : public Print {
+public:
+  virtual int available() { return 0; }
+  virtual int read() { return -1; }
+  virtual void flush() {}
+  size_t readBytes(uint8_t* buffer, size_t length) {
+    size_t count = 0;
+    while(count < length) {
+      int c = read();
+      if(c < 0) break;
+      buffer[count++] = (uint8_t)c;
+    }
+    return count;
+  }
+};
+
+// As in the real core, so Serial is always declared
+#include "HardwareSerial.h"
+
+#endif  // COMMANDSTATION_SIMULATOR_SHIM_ARDUINO_H_
@@ -0,0 +1,4 @@
+#include "Arduino.h"
+
+#define digitalWrite2 digitalWrite
+#define digitalRead2 digitalRead
@@ -0,0 +1,68 @@
+/*
+ *  EEPROM.h
+ * 
+ *  This file is part of CommandStation.
+ *
+ *  CommandStation is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  CommandStation is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with CommandStation.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef COMMANDSTATION_SIMULATOR_SHIM_EEPROM_H_
+#define COMMANDSTATION_SIMULATOR_SHIM_EEPROM_H_
+
+#include "Arduino.h"
+
+#include <string.h>
+
+// The 4KB EEPROM of an Arduino Mega. Starts erased (all 0xFF) and keeps its
+// contents across SimHardware::reset(), like the real thing across a reboot.
+// setLength makes it report a smaller size, such as the 1KB of an Uno.
+class EEPROMClass {
+public:
+  static const uint16_t kSize = 4096;
+
+  EEPROMClass() { memset(data, 0xFF, sizeof(data)); }
+
+  uint8_t read(int address) { reads++; return data[address]; }
+  void write(int address, uint8_t value) { data[address] = value; writes++; }
+  void update(int address, uint8_t value) {
+    if(data[address] != value) write(address, value);
+  }
+  uint16_t length() { return size; }
+  void setLength(uint16_t bytes) { size = bytes; }
+
+  template<class T> T& get(int address, T& t) {
+    memcpy(&t, data + address, sizeof(T));
+    reads += sizeof(T);
+    return t;
+  }
+  template<class T> const T& put(int address, const T& t) {
+    const uint8_t* bytes = (const uint8_t*)&t;
+    for(size_t i = 0; i < sizeof(T); i++) update(address + i, bytes[i]);
+    return t;
+  }
+
+  // Number of bytes actually written, for wear checks
+  uint32_t writes = 0;
+  // Number of bytes read, for the time spent on a slow EEPROM
+  uint32_t reads = 0;
+
+private:
+  uint8_t data[kSize];
+  uint16_t size = kSize;
+};
+
+extern EEPROMClass EEPROM;
+
+#endif  // COMMANDSTATION_SIMULATOR_SHIM_EEPROM_H_
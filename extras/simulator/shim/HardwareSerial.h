@@ -0,0 +1,59 @@
+/*
+ *  HardwareSerial.h
+ * 
+ *  This file is part of CommandStation.
+ *
+ *  CommandStation is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  CommandStation is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with CommandStation.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef COMMANDSTATION_SIMULATOR_SHIM_HARDWARESERIAL_H_
+#define COMMANDSTATION_SIMULATOR_SHIM_HARDWARESERIAL_H_
+
+#include "Arduino.h"
+
+#include <string>
+
+// A UART connected to the simulator. Bytes given to receive() are read back
+// by the sketch, everything the sketch writes is kept until takeOutput().
+class HardwareSerial : public Stream {
+public:
+  void begin(long baud) { (void)baud; }
+  void end() {}
+  size_t write(uint8_t c) { output += (char)c; return 1; }
+  int available() { return input.size() - readPosition; }
+  int read() { 
+    if(readPosition >= input.size()) return -1;
+    return (uint8_t)input[readPosition++];
+  }
+
+  void receive(const std::string& bytes) { 
+    input.erase(0, readPosition);
+    readPosition = 0;
+    input += bytes; 
+  }
+  std::string takeOutput() { 
+    std::string taken;
+    taken.swap(output);
+    return taken;
+  }
+
+private:
+  std::string input;
+  size_t readPosition = 0;
+  std::string output;
+};
+
+extern HardwareSerial Serial;
+
+#endif  // COMMANDSTATION_SIMULATOR_SHIM_HARDWARESERIAL_H_
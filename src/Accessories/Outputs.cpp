@@ -31,7 +31,7 @@ void Output::activate(Print* stream, int s){
   data.oStatus=(s>0);             
   // set state of output pin to HIGH or LOW depending on whether bit zero of 
   // iFlag is set to 0 (ACTIVE=HIGH) or 1 (ACTIVE=LOW)                                  
-  digitalWrite(data.pin,data.oStatus ^ bitRead(data.iFlag,0));      
+  output.write(data.oStatus ^ bitRead(data.iFlag,0));      
   if(num>0)
     EEPROM.put(num,data.oStatus);
   CommManager::send(stream, F("<Y %d %d>"), data.id, data.oStatus);
@@ -137,6 +137,7 @@ Output *Output::create(Print* stream, int id, int pin, int iFlag, int v){
   tt->data.pin=pin;
   tt->data.iFlag=iFlag;
   tt->data.oStatus=0;
+  tt->output.attach(pin);
 
   if(v==1){
     tt->data.oStatus=bitRead(tt->data.iFlag,1)?bitRead(tt->data.iFlag,2):0;      // sets status to 0 (INACTIVE) is bit 1 of iFlag=0, otherwise set to value of bit 2 of iFlag
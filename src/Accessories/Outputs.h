@@ -22,6 +22,8 @@
 
 #include <Arduino.h>
 
+#include "../Boards/FastPin.h"
+
 struct OutputData {
   uint8_t oStatus;
   uint8_t id;
@@ -33,6 +35,7 @@ struct Output {
   static Output *firstOutput;
   int num;
   struct OutputData data;
+  FastPin output;
   Output *nextOutput;
   void activate(Print* stream, int s);
   static void parse(Print* stream, const char *c);
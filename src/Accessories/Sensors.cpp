@@ -20,6 +20,7 @@
 #include "Sensors.h"
 
 #include "../CommInterface/CommManager.h"
+#include "../Diagnostics/LoopProfiler.h"
 #include "EEStore.h"
 
 #if !defined(ARDUINO_ARCH_SAMD) && !defined(ARDUINO_ARCH_SAMC)
@@ -27,10 +28,11 @@
 #endif
 
 void Sensor::check(Print* stream){
+  LOOP_PROFILE_SCOPE(kSectionSensors);
   Sensor *tt;
 
   for(tt=firstSensor;tt!=NULL;tt=tt->nextSensor){
-    tt->signal = tt->signal * (1.0 - SENSOR_DECAY) + digitalRead(tt->data.pin) * SENSOR_DECAY;
+    tt->signal = tt->signal * (1.0 - SENSOR_DECAY) + tt->input.read() * SENSOR_DECAY;
 
     if(!tt->active && tt->signal<0.5){
       tt->active=true;
@@ -72,6 +74,7 @@ Sensor *Sensor::create(Print* stream, int snum, int pin, int pullUp, int v){
   // Don't use Arduino's internal pull-up resistors for external infrared 
   // sensors --- each sensor must have its own 1K external pull-up resistor
   digitalWrite(pin,pullUp);   
+  tt->input.attach(pin);
 
   if(v==1)
     CommManager::send(stream, F("<O>"));
@@ -22,6 +22,8 @@
 
 #include "Arduino.h"
 
+#include "../Boards/FastPin.h"
+
 #define  SENSOR_DECAY  0.03
 
 struct SensorData {
@@ -35,6 +37,7 @@ struct Sensor{
   SensorData data;
   boolean active;
   float signal;
+  FastPin input;
   Sensor *nextSensor;
   static void load(Print* stream);
   static void store();
@@ -22,14 +22,9 @@
 
 #include <Arduino.h>
 #include "AnalogReadFast.h"
-
-#if defined(ARDUINO_ARCH_SAMD) || defined(ARDUINO_ARCH_SAMC)
-#define writePin digitalWrite
-#elif defined(ARDUINO_ARCH_AVR)
-// Library DIO2.h is only compatible with AVR.
-#include <DIO2.h>
-#define writePin digitalWrite2
-#endif
+#include "CurrentSampler.h"
+#include "CurrentTelemetry.h"
+#include "FastPin.h"
 
 #define ON  true
 #define OFF false
@@ -37,11 +32,37 @@
 // Time between current samples (millis)
 const int kCurrentSampleTime = 1;
 
-// Smoothing constant for exponential current smoothing algorithm
-const float kCurrentSampleSmoothing = 0.01;
+// Current readings are smoothed with an exponential moving average that 
+// gives each new sample a weight of 1/2^kCurrentSmoothingShift (1/128)
+const uint8_t kCurrentSmoothingShift = 7;
+
+// Sustained overloads trip on an I2t curve. Every sample above the trip 
+// current adds the excess of its square over the trip current's square, and 
+// the board trips when that reaches kOverloadSamples squared trip currents. 
+// Twice the trip current trips after about 17 samples, 1.1x after about 240.
+const uint8_t kOverloadSamples = 50;
 
-// Number of milliseconds between retries when the "breaker" is tripped.
-const int kRetryTime = 10000;
+// Overload recovery. After a trip the board waits kRecoveryFirstDelay, then 
+// turns the power on for a kRecoveryProbeTime probe. If the current is below 
+// the trip current at the end of it the power stays on, otherwise the wait 
+// doubles up to kRecoveryMaxDelay. A board that trips again within 
+// kRecoveryStableTime of recovering keeps backing off. (millis)
+const uint16_t kRecoveryFirstDelay = 250;
+const uint32_t kRecoveryMaxDelay = 64000;
+const uint8_t kRecoveryProbeTime = 3;
+const uint16_t kRecoveryStableTime = 5000;
+
+enum BoardTripKind : uint8_t {
+  kTripFast,      // Short circuit, cut by the current sampler
+  kTripOverload,  // Sustained overload, cut by the I2t curve
+};
+
+// The last time a board tripped
+struct boardTripEvent {
+  uint32_t time;        // micros
+  uint16_t milliamps;   // Current that caused the trip
+  BoardTripKind kind;
+};
 
 struct BoardConfig
 {
@@ -53,10 +74,12 @@ struct BoardConfig
   float board_voltage;
   float amps_per_volt;
   uint16_t current_trip;
+  uint16_t current_trip_fast;   // Short circuit threshold, 0 turns it off
   uint16_t current_trip_prog;
   uint16_t prog_trip_time;
   uint8_t main_preambles;
   uint8_t prog_preambles;
+  bool reverser;      // Flip the polarity on a short instead of tripping
   void (*track_power_callback)(const char* name, bool status);
 };
 
@@ -67,13 +90,21 @@ public:
   virtual const char* getName() = 0;
 
   virtual void power(bool, bool announce) = 0;
-  virtual void signal(bool) = 0;
+
+  // Called from the waveform ISR, so not virtual. They only write the pins 
+  // the board attached in its setup.
+  void signal(bool dir) {
+    signalPin.write(dir != CurrentSampler::reversed(senseChannel));
+  }
   // True to enter a railcom cutout, false to recover
-  virtual void cutout(bool) = 0;
+  void cutout(bool on) {
+    cutoutPin.write(on ? cutoutLevel : !cutoutLevel);
+  }
   // True to enter prog mode and limit current
   virtual void progMode(bool) = 0;
 
-  // Returns current reading 0-1024
+  // Returns the latest current reading 0-1024, without waiting for the ADC.
+  // May be called from an interrupt.
   virtual uint16_t getCurrentRaw() = 0;   
   // Returns current reading in mA
   virtual uint16_t getCurrentMilliamps() = 0;
@@ -83,12 +114,57 @@ public:
   virtual uint16_t getCurrentBase() = 0;
 
   virtual bool getStatus() = 0;
+  // The pin that turns the power on, which boards may share
+  virtual uint8_t getEnablePin() = 0;
 
   virtual void checkOverload() = 0;
 
+  // Fills in the last trip and returns the number of trips since start up, 
+  // 0 if the board never tripped. Failed probes are not counted as trips.
+  uint16_t getLastTrip(boardTripEvent& event) {
+    event = lastTrip;
+    return tripCount;
+  }
+  uint16_t getFailedProbes() { return failedProbes; }
+  // True from a trip until the board has recovered
+  bool isTripped() { return tripped; }
+  // Ends any recovery from a trip. While held the board doesn't recover 
+  // from new trips either, so whatever turned its power off decides when 
+  // it comes back on.
+  void hold(bool on) {
+    held = on;
+    tripped = false;
+    probing = false;
+  }
+  // Moving average of the current in mA, see kCurrentSmoothingShift
+  uint16_t getCurrentSmoothed() { return countsToMilliamps(reading); }
+  // Times an auto reverser board has flipped its polarity
+  uint16_t getPolarityFlips() { return CurrentSampler::flips(senseChannel); }
+
+  // Current over a telemetry window, all in mA
+  CurrentWindowStats getCurrentWindow(CurrentWindow which) {
+    CurrentWindowStats stats = telemetry.window(which);
+    stats.min = countsToMilliamps(stats.min);
+    stats.max = countsToMilliamps(stats.max);
+    stats.mean = meanToMilliamps(stats.mean);
+    return stats;
+  }
+  // One second means in mA, oldest first. Returns how many there are.
+  uint8_t getCurrentHistory(uint16_t milliamps[kTelemetrySeconds]) {
+    uint8_t kept = telemetry.history(milliamps);
+    for(uint8_t i = 0; i < kept; i++) 
+      milliamps[i] = meanToMilliamps(milliamps[i]);
+    return kept;
+  }
+
   virtual uint8_t getPreambles() = 0;
 protected:
+  FastPin signalPin;
+  FastPin cutoutPin;
+  bool cutoutLevel;       // Level of cutoutPin during a railcom cutout
+
   // Current reading variables
+  uint8_t senseChannel;   // CurrentSampler channel of the sense pin
   uint16_t reading;
   bool tripped;
   long int lastCheckTime;
@@ -100,6 +176,156 @@ protected:
   uint16_t currentBase;
 
   virtual bool isCurrentLimiting() = 0;
+
+  // Integer current pipeline shared by all boards. setCurrentScale is called
+  // from setup, after which converting and smoothing readings needs no 
+  // floating point.
+  uint32_t milliampsPerCount;   // Q16
+  uint32_t smoothedReading;     // Scaled up by 2^kCurrentSmoothingShift
+  uint32_t overloadHeat;        // I2t above the trip current, counts squared
+  CurrentTelemetry telemetry;
+
+  // A trip current worked out in counts once, so that checking a reading 
+  // against it needs no division
+  struct TripLevel {
+    uint16_t counts;      // Above 1023 if the ADC can't reach it
+    uint32_t squared;
+    uint32_t heatLimit;   // overloadHeat that trips
+  };
+  TripLevel tripLevel;        // current_trip
+  TripLevel progTripLevel;    // current_trip_prog
+
+  // Protection state
+  boardTripEvent lastTrip;
+  uint16_t tripCount;
+  uint16_t failedProbes;
+  bool held;
+  bool probing;
+  uint32_t probeStart;
+  uint32_t recoveryDelay;
+  uint32_t recoveredTime;
+
+  void setCurrentScale(const BoardConfig& config) {
+    milliampsPerCount = config.board_voltage * 1000 * config.amps_per_volt * 
+      65536 / 1023 + 0.5;
+    setTripLevels(config);
+    smoothedReading = 0;
+    overloadHeat = 0;
+    telemetry.reset();
+    tripCount = 0;
+    failedProbes = 0;
+    held = false;
+    probing = false;
+    recoveryDelay = 0;
+  }
+
+  // Telemetry means carry kTelemetryMeanShift fraction bits
+  uint16_t meanToMilliamps(uint16_t mean) {
+    uint32_t whole = mean >> kTelemetryMeanShift;
+    uint32_t fraction = mean & ((1 << kTelemetryMeanShift) - 1);
+    return (whole * milliampsPerCount + 
+      ((fraction * milliampsPerCount) >> kTelemetryMeanShift) + 0x8000) >> 16;
+  }
+
+  uint16_t milliampsToCounts(uint16_t milliamps) {
+    return ((uint32_t)milliamps << 16) / milliampsPerCount;
+  }
+
+  // Called by setCurrentScale and whenever the trip currents change
+  void setTripLevels(const BoardConfig& config) {
+    tripLevel = makeTripLevel(config.current_trip);
+    progTripLevel = makeTripLevel(config.current_trip_prog);
+  }
+
+  TripLevel makeTripLevel(uint16_t milliamps) {
+    TripLevel level;
+    level.counts = milliampsToCounts(milliamps);
+    level.squared = (uint32_t)level.counts * level.counts;
+    level.heatLimit = level.squared * kOverloadSamples;
+    return level;
+  }
+
+  uint16_t countsToMilliamps(uint16_t counts) {
+    return (counts * milliampsPerCount + 0x8000) >> 16;
+  }
+
+  // Adds a raw reading to the average and returns the new average
+  uint16_t smoothReading(uint16_t raw) {
+    smoothedReading = smoothedReading - 
+      (smoothedReading >> kCurrentSmoothingShift) + raw;
+    return (smoothedReading + (1 << (kCurrentSmoothingShift - 1))) >> 
+      kCurrentSmoothingShift;
+  }
+
+  // Adds a raw reading to the I2t curve and returns true once it trips. 
+  // Readings below the trip current cool it down again.
+  bool overloaded(uint16_t raw, const TripLevel& trip) {
+    if(trip.counts > 1023) return false;
+    uint32_t squared = (uint32_t)raw * raw;
+    if(squared > trip.squared) overloadHeat += squared - trip.squared;
+    else if(overloadHeat > trip.squared - squared) 
+      overloadHeat -= trip.squared - squared;
+    else overloadHeat = 0;
+    if(overloadHeat < trip.heatLimit) return false;
+    overloadHeat = trip.heatLimit;
+    return true;
+  }
+
+  // Turns the power off after an overload and starts recovering. A trip 
+  // during a probe only fails the probe, one while waiting is ignored.
+  void recordTrip(BoardTripKind kind, uint32_t time, uint16_t milliamps) {
+    if(tripped && !probing) return;
+    lastTrip.time = time;
+    lastTrip.milliamps = milliamps;
+    lastTrip.kind = kind;
+    overloadHeat = 0;
+    if(probing) {
+      failProbe();
+      return;
+    }
+    power(OFF, true);
+    tripCount++;
+    if(recoveryDelay != 0 && millis() - recoveredTime < kRecoveryStableTime)
+      backOff();
+    else recoveryDelay = kRecoveryFirstDelay;
+    tripped = true;
+    lastTripTime = millis();
+  }
+
+  // Runs the recovery while tripped: waits, probes, then turns the power 
+  // back on for good or waits longer
+  void recover(uint16_t tripMilliamps) {
+    if(held) return;
+    if(!probing) {
+      if(millis() - lastTripTime < recoveryDelay) return;
+      probing = true;
+      probeStart = millis();
+      power(ON, false);
+      return;
+    }
+    if(millis() - probeStart < kRecoveryProbeTime) return;
+    if(countsToMilliamps(getCurrentRaw()) >= tripMilliamps) {
+      failProbe();
+      return;
+    }
+    probing = false;
+    tripped = false;
+    recoveredTime = millis();
+    power(ON, true);
+  }
+
+  void failProbe() {
+    power(OFF, false);
+    probing = false;
+    failedProbes++;
+    backOff();
+    lastTripTime = millis();
+  }
+
+  void backOff() {
+    recoveryDelay = recoveryDelay * 2 > kRecoveryMaxDelay ? kRecoveryMaxDelay :
+      recoveryDelay * 2;
+  }
 };
 
 #endif  // COMMANDSTATION_BOARDS_BOARD_H_
\ No newline at end of file
@@ -1,97 +0,0 @@
-/*
- *  BoardPololuMotorShield.h
- * 
- *  This file is part of CommandStation.
- *
- *  CommandStation is free software: you can redistribute it and/or modify
- *  it under the terms of the GNU General Public License as published by
- *  the Free Software Foundation, either version 3 of the License, or
- *  (at your option) any later version.
- *
- *  CommandStation is distributed in the hope that it will be useful,
- *  but WITHOUT ANY WARRANTY; without even the implied warranty of
- *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
- *  GNU General Public License for more details.
- *
- *  You should have received a copy of the GNU General Public License
- *  along with CommandStation.  If not, see <https://www.gnu.org/licenses/>.
- */
-
-#ifndef COMMANDSTATION_BOARDS_BOARDPOLOLUMOTORSHIELD_H_
-#define COMMANDSTATION_BOARDS_BOARDPOLOLUMOTORSHIELD_H_
-
-#include "Board.h"
-
-struct BoardConfigPololuMotorShield : public BoardConfig {
-  // Used to store functionality special to this type of shield
-};
-
-class BoardPololuMotorShield : public Board
-{
-public:
-  BoardConfigPololuMotorShield config;
-
-  BoardPololuMotorShield(BoardConfigPololuMotorShield _config) {
-    config = _config;
-  }
-
-  static void getDefaultConfigA(BoardConfigPololuMotorShield& _config) {
-    _config.track_name = "A";
-    _config.signal_a_pin = 7;
-    _config.signal_b_pin = 9;
-    _config.enable_pin = 4;
-    _config.sense_pin = A0;   
-    _config.board_voltage = 5.0;
-    _config.amps_per_volt = 1.904762;
-    _config.current_trip = 3000;
-    _config.current_trip_prog = 250;
-    _config.prog_trip_time = 100;
-    _config.main_preambles = 16;
-    _config.prog_preambles = 22;
-    _config.track_power_callback = nullptr; // Needs to be set in the main file
-  }
-
-  static void getDefaultConfigB(BoardConfigPololuMotorShield& _config) {
-    _config.track_name = "B";
-    _config.signal_a_pin = 8;
-    _config.signal_b_pin = 10;
-    _config.enable_pin = 4;
-    _config.sense_pin = A1;       
-    _config.board_voltage = 5.0;
-    _config.amps_per_volt = 1.904762;
-    _config.current_trip = 3000;
-    _config.current_trip_prog = 250;
-    _config.prog_trip_time = 100;
-    _config.main_preambles = 16;
-    _config.prog_preambles = 22;
-    _config.track_power_callback = nullptr; // Needs to be set in the main file
-  }
-
-  void setup();
-
-  const char* getName();
-  
-  void power(bool, bool announce);
-  void signal(bool);
-  void cutout(bool);
-  void progMode(bool);
-
-  uint16_t getCurrentRaw();
-  uint16_t getCurrentMilliamps();
-  uint16_t getCurrentMilliamps(uint16_t reading);
-
-  uint16_t setCurrentBase();
-  uint16_t getCurrentBase();
-
-  bool getStatus();
-
-  void checkOverload();
-
-  uint8_t getPreambles();
-  
-private:
-  bool isCurrentLimiting();
-};
-
-
-#endif
\ No newline at end of file
@@ -0,0 +1,275 @@
+/*
+ *  CurrentSampler.cpp
+ * 
+ *  This file is part of CommandStation.
+ *
+ *  CommandStation is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  CommandStation is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with CommandStation.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include "CurrentSampler.h"
+
+#include "AnalogReadFast.h"
+
+#if defined(CURRENT_SAMPLER_SAMD)
+#include <wiring_private.h>
+#endif
+
+uint8_t CurrentSampler::pins[kCurrentSamplerChannels];
+uint8_t CurrentSampler::channels = 0;
+uint8_t CurrentSampler::current = 0;
+bool CurrentSampler::started = false;
+volatile bool CurrentSampler::busy = false;
+uint8_t CurrentSampler::tickCount = 0;
+uint8_t CurrentSampler::busyTicks = 0;
+volatile uint16_t 
+  CurrentSampler::samples[kCurrentSamplerChannels][kCurrentSamplerDepth];
+volatile uint8_t CurrentSampler::heads[kCurrentSamplerChannels];
+volatile uint32_t CurrentSampler::conversionCount = 0;
+uint16_t CurrentSampler::fastLimit[kCurrentSamplerChannels];
+FastPin CurrentSampler::fastPin[kCurrentSamplerChannels];
+volatile uint8_t CurrentSampler::fastCount[kCurrentSamplerChannels];
+volatile bool CurrentSampler::fastTripped[kCurrentSamplerChannels];
+volatile uint32_t CurrentSampler::fastTime[kCurrentSamplerChannels];
+volatile uint16_t CurrentSampler::fastCounts[kCurrentSamplerChannels];
+bool CurrentSampler::reverser[kCurrentSamplerChannels];
+FastPin CurrentSampler::reverserPin[kCurrentSamplerChannels];
+volatile bool CurrentSampler::polarity[kCurrentSamplerChannels];
+volatile bool CurrentSampler::settling[kCurrentSamplerChannels];
+volatile uint32_t CurrentSampler::flipTime[kCurrentSamplerChannels];
+volatile uint16_t CurrentSampler::flipCount[kCurrentSamplerChannels];
+
+uint8_t CurrentSampler::addPin(uint8_t pin) {
+  for(uint8_t channel = 0; channel < channels; channel++) 
+    if(pins[channel] == pin) return channel;
+  if(channels >= kCurrentSamplerChannels) return kCurrentSamplerNoChannel;
+
+#if defined(CURRENT_SAMPLER_SAMD)
+  pinPeripheral(pin, PIO_ANALOG);
+#endif
+  pins[channels] = pin;
+  // The interrupt only looks at channels, so the pin must be in place first
+  return channels++;
+}
+
+#if defined(CURRENT_SAMPLER_AVR)
+
+void CurrentSampler::setupAdc() {
+  // Same prescaler as analogReadFast (16), with the conversion interrupt
+  ADCSRA = _BV(ADEN) | _BV(ADIE) | _BV(ADPS2);
+}
+
+void CurrentSampler::startConversion(uint8_t pin) {
+  uint8_t channel = pin >= A0 ? pin - A0 : pin;
+#if defined(MUX5)
+  ADCSRB = (ADCSRB & ~_BV(MUX5)) | (((channel >> 3) & 0x01) << MUX5);
+#endif
+  // AVcc reference, as analogRead uses by default
+  ADMUX = _BV(REFS0) | (channel & 0x07);
+  ADCSRA |= _BV(ADSC);
+}
+
+ISR(ADC_vect) {
+  CurrentSampler::complete(ADC);
+}
+
+#elif defined(CURRENT_SAMPLER_SAMD)
+
+void CurrentSampler::setupAdc() {
+  // The settings analogReadFast makes for each reading, made once
+  ADC->CTRLA.bit.ENABLE = 0;
+  while(ADC->STATUS.bit.SYNCBUSY == 1);
+  ADC->CTRLB.reg &= 0b1111100011111111;          // mask PRESCALER bits
+  ADC->CTRLB.reg |= ADC_CTRLB_PRESCALER_DIV64;   // divide Clock by 64
+  ADC->AVGCTRL.reg = ADC_AVGCTRL_SAMPLENUM_1 |   // take 1 sample 
+                     ADC_AVGCTRL_ADJRES(0x00ul); // adjusting result by 0
+  ADC->SAMPCTRL.reg = 0x00;                      // sampling Time Length = 0
+  ADC->INTENSET.reg = ADC_INTENSET_RESRDY;
+  NVIC_EnableIRQ(ADC_IRQn);
+  ADC->CTRLA.bit.ENABLE = 1;
+  while(ADC->STATUS.bit.SYNCBUSY == 1);
+}
+
+void CurrentSampler::startConversion(uint8_t pin) {
+  ADC->INPUTCTRL.bit.MUXPOS = g_APinDescription[pin].ulADCChannelNumber;
+  while(ADC->STATUS.bit.SYNCBUSY == 1);
+  ADC->SWTRIG.bit.START = 1;
+}
+
+void ADC_Handler() {
+  // Reading the result clears the interrupt
+  CurrentSampler::complete(ADC->RESULT.reg);
+}
+
+#endif
+
+#if defined(CURRENT_SAMPLER_AVR) || defined(CURRENT_SAMPLER_SAMD)
+
+void CurrentSampler::begin() {
+  if(started || channels == 0) return;
+  setupAdc();
+  current = channels - 1;
+  started = true;
+}
+
+void CurrentSampler::tick() {
+  if(!started) return;
+  if(busy) {
+    // Taken away by an analogRead
+    if(++busyTicks >= kCurrentSamplerStallTicks) {
+      setupAdc();
+      busy = false;
+    }
+    return;
+  }
+  if(++tickCount < kCurrentSamplerTicks) return;
+  tickCount = 0;
+
+  if(++current >= channels) current = 0;
+  busy = true;
+  busyTicks = 0;
+  startConversion(pins[current]);
+}
+
+void CurrentSampler::complete(uint16_t value) {
+  // A result nobody asked for, from an analogRead elsewhere
+  if(!busy) return;
+  busy = false;
+  store(current, value);
+}
+
+void CurrentSampler::poll(uint8_t channel) {
+  (void)channel;
+}
+
+#else
+
+void CurrentSampler::begin() {
+  started = true;
+}
+
+void CurrentSampler::tick() {
+}
+
+void CurrentSampler::complete(uint16_t value) {
+  (void)value;
+}
+
+void CurrentSampler::poll(uint8_t channel) {
+  if(channel < channels) store(channel, analogReadFast(pins[channel]));
+}
+
+#endif
+
+void CurrentSampler::store(uint8_t channel, uint16_t value) {
+  uint8_t head = (heads[channel] + 1) & (kCurrentSamplerDepth - 1);
+  samples[channel][head] = value;
+  // Readers use heads to find the latest sample, so it moves last
+  heads[channel] = head;
+  conversionCount++;
+
+  // A short circuit, cut the power now and let the board catch up. Nothing
+  // to do while the power is off.
+  if(fastLimit[channel] != 0 && !fastTripped[channel] && 
+    fastPin[channel].read()) {
+    if(value <= fastLimit[channel]) fastCount[channel] = 0;
+    else if(++fastCount[channel] >= kCurrentSamplerFastSamples) {
+      uint32_t now = micros();
+      fastCount[channel] = 0;
+      if(settling[channel] && now - flipTime[channel] > kReverserSettleMicros)
+        settling[channel] = false;
+      if(reverser[channel] && !settling[channel]) {
+        // A train crossing into the reversing section, swap the outputs 
+        // and keep the packets going
+        polarity[channel] = !polarity[channel];
+        reverserPin[channel].write(!reverserPin[channel].read());
+        flipTime[channel] = now;
+        flipCount[channel]++;
+        settling[channel] = true;
+      }
+      else {
+        fastPin[channel].write(LOW);
+        fastTime[channel] = now;
+        fastCounts[channel] = value;
+        fastTripped[channel] = true;
+      }
+    }
+  }
+}
+
+uint16_t CurrentSampler::latest(uint8_t channel) {
+  if(channel >= channels) return 0;
+  // Single byte read, and the slot it points at isn't written again until 
+  // the ring has gone all the way round
+  return samples[channel][heads[channel]];
+}
+
+uint8_t CurrentSampler::recent(uint8_t channel, uint16_t buffer[], 
+  uint8_t count) {
+  if(channel >= channels || count == 0) return 0;
+  // The oldest slot is the next one to be written
+  if(count > kCurrentSamplerDepth - 1) count = kCurrentSamplerDepth - 1;
+  uint8_t head = heads[channel];
+  for(uint8_t i = 0; i < count; i++) 
+    buffer[i] = samples[channel][(head - i) & (kCurrentSamplerDepth - 1)];
+  return count;
+}
+
+void CurrentSampler::setFastTrip(uint8_t channel, uint16_t limit, 
+  uint8_t enablePin) {
+  if(channel >= channels) return;
+  noInterrupts();
+  fastLimit[channel] = limit;
+  fastPin[channel].attach(enablePin);
+  fastCount[channel] = 0;
+  fastTripped[channel] = false;
+  interrupts();
+}
+
+bool CurrentSampler::takeFastTrip(uint8_t channel, uint32_t& time, 
+  uint16_t& counts) {
+  if(channel >= channels || !fastTripped[channel]) return false;
+  noInterrupts();
+  time = fastTime[channel];
+  counts = fastCounts[channel];
+  fastTripped[channel] = false;
+  interrupts();
+  return true;
+}
+
+void CurrentSampler::setReverser(uint8_t channel, bool on, 
+  uint8_t signalPin) {
+  if(channel >= channels) return;
+  noInterrupts();
+  reverser[channel] = on;
+  reverserPin[channel].attach(signalPin);
+  polarity[channel] = false;
+  settling[channel] = false;
+  interrupts();
+}
+
+uint16_t CurrentSampler::flips(uint8_t channel) {
+  if(channel >= channels) return 0;
+  noInterrupts();
+  uint16_t count = flipCount[channel];
+  interrupts();
+  return count;
+}
+
+uint32_t CurrentSampler::conversions() {
+  noInterrupts();
+  uint32_t count = conversionCount;
+  interrupts();
+  return count;
+}
@@ -0,0 +1,140 @@
+/*
+ *  CurrentSampler.h
+ * 
+ *  This file is part of CommandStation.
+ *
+ *  CommandStation is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  CommandStation is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with CommandStation.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef COMMANDSTATION_BOARDS_CURRENTSAMPLER_H_
+#define COMMANDSTATION_BOARDS_CURRENTSAMPLER_H_
+
+#include <Arduino.h>
+
+#include "FastPin.h"
+
+// The ADC converts the sense pins of all boards in turn, in the background,
+// on the targets listed here. Elsewhere poll takes a blocking analogReadFast
+// from the main loop.
+#if defined(ARDUINO_ARCH_SAMD)
+#define CURRENT_SAMPLER_SAMD
+#elif defined(ARDUINO_ARCH_AVR) && !defined(ARDUINO_AVR_UNO_WIFI_REV2) && \
+  !defined(ARDUINO_AVR_NANO_EVERY)
+#define CURRENT_SAMPLER_AVR
+#endif
+
+// Sense pins that can be sampled
+const uint8_t kCurrentSamplerChannels = 6;
+// Samples kept per pin, must be a power of two
+const uint8_t kCurrentSamplerDepth = 8;
+const uint8_t kCurrentSamplerNoChannel = 0xFF;
+// Calls to tick per conversion. Each track calls it every waveform tick, so
+// with a track per board each pin is sampled about every 6 ticks (5.7kHz).
+const uint8_t kCurrentSamplerTicks = 6;
+// Calls to tick after which a conversion that never finished is given up and
+// the ADC set up again
+const uint8_t kCurrentSamplerStallTicks = 64;
+// Samples in a row above the fast trip limit that cut the power
+const uint8_t kCurrentSamplerFastSamples = 4;
+// A reverser that sees the fast trip again this soon after flipping is 
+// looking at a real short, and cuts the power (micros)
+const uint16_t kReverserSettleMicros = 5000;
+
+// Background current sampling. The waveform interrupts start a conversion of
+// the next pin at a fixed rate through tick, and the conversion interrupt 
+// stores the result in the pin's ring buffer. Reading a sample never waits 
+// for the ADC.
+//
+// Once begun the sampler owns the ADC. An analogRead elsewhere upsets it: on
+// AVR its result would be taken for a sample (it's dropped instead) and it
+// can spoil the conversion in flight, on SAMD it disables the ADC. A 
+// conversion that doesn't finish is given up after kCurrentSamplerStallTicks
+// and the ADC set up again, so sampling carries on, but other analog inputs
+// should be added with addPin and read with latest instead.
+struct CurrentSampler {
+  // Adds a pin to the round robin, or finds it if it's already there. 
+  // Returns its channel, or kCurrentSamplerNoChannel if all are in use.
+  static uint8_t addPin(uint8_t pin);
+  // Sets up the ADC once there is a pin. Safe to call more than once.
+  static void begin();
+  // Starts the next conversion every kCurrentSamplerTicks calls. Called by
+  // each track's waveform interrupt.
+  static void tick();
+  // Takes a reading of the channel on targets without background sampling,
+  // where it's called from the main loop. Does nothing elsewhere.
+  static void poll(uint8_t channel);
+
+  // Latest sample, 0-1023. May be called from an interrupt.
+  static uint16_t latest(uint8_t channel);
+  // Copies up to count samples, newest first, and returns how many
+  static uint8_t recent(uint8_t channel, uint16_t samples[], uint8_t count);
+  // Conversions done since start up, to measure the sample rate
+  static uint32_t conversions();
+
+  // Fast trip. The conversion interrupt drives enablePin low as soon as 
+  // kCurrentSamplerFastSamples samples in a row are above limit (counts), 
+  // without waiting for the main loop. A limit of 0 turns it off. 
+  static void setFastTrip(uint8_t channel, uint16_t limit, uint8_t enablePin);
+  // True if the fast trip has fired since the last call, with the time 
+  // (micros) and the sample that fired it. Re-arms the trip.
+  static bool takeFastTrip(uint8_t channel, uint32_t& time, uint16_t& counts);
+
+  // Auto reverser. The fast trip flips the channel's polarity instead, by
+  // inverting signalPin at once, and only cuts the power if it fires again 
+  // within kReverserSettleMicros.
+  static void setReverser(uint8_t channel, bool on, uint8_t signalPin);
+  // True while the channel's signal must be inverted. May be called from an
+  // interrupt.
+  static bool reversed(uint8_t channel) { 
+    return channel < channels && polarity[channel]; 
+  }
+  // Polarity flips since start up
+  static uint16_t flips(uint8_t channel);
+
+  // Stores a finished conversion. Only called from the ADC interrupt.
+  static void complete(uint16_t value);
+
+private:
+  static uint8_t pins[kCurrentSamplerChannels];
+  static uint8_t channels;
+  static uint8_t current;       // Channel converted last
+  static bool started;
+  static volatile bool busy;    // A conversion is in flight
+  static uint8_t tickCount;
+  static uint8_t busyTicks;
+  static volatile uint16_t samples[kCurrentSamplerChannels][kCurrentSamplerDepth];
+  static volatile uint8_t heads[kCurrentSamplerChannels];
+  static volatile uint32_t conversionCount;
+
+  static uint16_t fastLimit[kCurrentSamplerChannels];
+  static FastPin fastPin[kCurrentSamplerChannels];
+  static volatile uint8_t fastCount[kCurrentSamplerChannels];
+  static volatile bool fastTripped[kCurrentSamplerChannels];
+  static volatile uint32_t fastTime[kCurrentSamplerChannels];
+  static volatile uint16_t fastCounts[kCurrentSamplerChannels];
+
+  static bool reverser[kCurrentSamplerChannels];
+  static FastPin reverserPin[kCurrentSamplerChannels];
+  static volatile bool polarity[kCurrentSamplerChannels];
+  static volatile bool settling[kCurrentSamplerChannels];
+  static volatile uint32_t flipTime[kCurrentSamplerChannels];
+  static volatile uint16_t flipCount[kCurrentSamplerChannels];
+
+  static void setupAdc();
+  static void startConversion(uint8_t pin);
+  static void store(uint8_t channel, uint16_t value);
+};
+
+#endif  // COMMANDSTATION_BOARDS_CURRENTSAMPLER_H_
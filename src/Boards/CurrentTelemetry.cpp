@@ -0,0 +1,96 @@
+/*
+ *  CurrentTelemetry.cpp
+ * 
+ *  This file is part of CommandStation.
+ *
+ *  CommandStation is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  CommandStation is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with CommandStation.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include "CurrentTelemetry.h"
+
+void CurrentTelemetry::reset() {
+  memset(this, 0, sizeof(*this));
+}
+
+void CurrentTelemetry::add(uint16_t raw, uint32_t now) {
+  if(count == 0 && secondsKept == 0 && secondStart == 0) secondStart = now;
+
+  if(now - secondStart >= 1000) {
+    if(count != 0) {
+      CurrentWindowStats& second = seconds[secondsHead];
+      second.min = min;
+      second.max = max;
+      second.mean = (sum << kTelemetryMeanShift) / count;
+      secondsHead = (secondsHead + 1) % kTelemetrySeconds;
+      if(secondsKept < kTelemetrySeconds) secondsKept++;
+
+      if(++secondsInTen == kTelemetrySeconds) {
+        secondsInTen = 0;
+        tens[tensHead] = combine(seconds, kTelemetrySeconds, secondsHead, 
+          kTelemetrySeconds);
+        tensHead = (tensHead + 1) % kTelemetryTens;
+        if(tensKept < kTelemetryTens) tensKept++;
+      }
+    }
+    sum = 0;
+    count = 0;
+    // Keep to whole seconds unless the loop stalled for longer than one
+    secondStart = now - secondStart < 2000 ? secondStart + 1000 : now;
+  }
+
+  if(count == 0 || raw < min) min = raw;
+  if(count == 0 || raw > max) max = raw;
+  sum += raw;
+  count++;
+}
+
+CurrentWindowStats CurrentTelemetry::window(CurrentWindow which) const {
+  switch(which) {
+  case kWindowSecond:
+    return combine(seconds, kTelemetrySeconds, secondsHead, 
+      secondsKept < 1 ? secondsKept : 1);
+  case kWindowTenSeconds:
+    return combine(seconds, kTelemetrySeconds, secondsHead, secondsKept);
+  default:
+    // Until the first ten seconds are summarised, the seconds are all there is
+    if(tensKept == 0) 
+      return combine(seconds, kTelemetrySeconds, secondsHead, secondsKept);
+    return combine(tens, kTelemetryTens, tensHead, tensKept);
+  }
+}
+
+uint8_t CurrentTelemetry::history(uint16_t means[kTelemetrySeconds]) const {
+  uint8_t slot = (secondsHead + kTelemetrySeconds - secondsKept) % 
+    kTelemetrySeconds;
+  for(uint8_t i = 0; i < secondsKept; i++) {
+    means[i] = seconds[slot].mean;
+    slot = (slot + 1) % kTelemetrySeconds;
+  }
+  return secondsKept;
+}
+
+CurrentWindowStats CurrentTelemetry::combine(const CurrentWindowStats ring[], 
+  uint8_t size, uint8_t head, uint8_t n) {
+  CurrentWindowStats stats = {0, 0, 0};
+  uint32_t sum = 0;
+  for(uint8_t i = 0; i < n; i++) {
+    const CurrentWindowStats& entry = ring[(head + size - 1 - i) % size];
+    if(i == 0 || entry.min < stats.min) stats.min = entry.min;
+    if(i == 0 || entry.max > stats.max) stats.max = entry.max;
+    sum += entry.mean;
+  }
+  if(n != 0) stats.mean = sum / n;
+  return stats;
+}
@@ -0,0 +1,82 @@
+/*
+ *  CurrentTelemetry.h
+ * 
+ *  This file is part of CommandStation.
+ *
+ *  CommandStation is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  CommandStation is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with CommandStation.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef COMMANDSTATION_BOARDS_CURRENTTELEMETRY_H_
+#define COMMANDSTATION_BOARDS_CURRENTTELEMETRY_H_
+
+#include <Arduino.h>
+
+// Windows reported by CurrentTelemetry
+enum CurrentWindow : uint8_t {
+  kWindowSecond,      // The last complete second
+  kWindowTenSeconds,  // The last ten complete seconds
+  kWindowMinute,      // The last six complete ten second blocks
+  kCurrentWindows
+};
+
+// Means carry this many fraction bits
+const uint8_t kTelemetryMeanShift = 4;
+// One second summaries kept, also the history reported
+const uint8_t kTelemetrySeconds = 10;
+// Ten second summaries kept for the minute window
+const uint8_t kTelemetryTens = 6;
+
+// Current over one window, in ADC counts
+struct CurrentWindowStats {
+  uint16_t min;
+  uint16_t max;
+  uint16_t mean;    // Fixed point, kTelemetryMeanShift fraction bits
+};
+
+// Current statistics of one board, fed with the samples checkOverload takes.
+// Samples are summed into one second summaries, every ten of those into a 
+// ten second summary, so the windows slide in whole seconds and ten seconds 
+// in a fixed amount of memory. All zeros is a valid empty history.
+struct CurrentTelemetry {
+  void reset();
+  // Adds a raw sample taken at now (millis)
+  void add(uint16_t raw, uint32_t now);
+  // Summary of a window, all zeros until a second has gone by
+  CurrentWindowStats window(CurrentWindow which) const;
+  // Copies the one second means, oldest first, and returns how many
+  uint8_t history(uint16_t means[kTelemetrySeconds]) const;
+
+private:
+  // Samples of the second being summed
+  uint32_t secondStart;
+  uint32_t sum;
+  uint16_t count;
+  uint16_t min;
+  uint16_t max;
+
+  CurrentWindowStats seconds[kTelemetrySeconds];
+  uint8_t secondsHead;    // Next slot to write
+  uint8_t secondsKept;
+  uint8_t secondsInTen;   // Seconds since the last ten second summary
+  CurrentWindowStats tens[kTelemetryTens];
+  uint8_t tensHead;
+  uint8_t tensKept;
+
+  // Combines the newest n summaries of a ring
+  static CurrentWindowStats combine(const CurrentWindowStats ring[], 
+    uint8_t size, uint8_t head, uint8_t n);
+};
+
+#endif  // COMMANDSTATION_BOARDS_CURRENTTELEMETRY_H_
@@ -0,0 +1,93 @@
+/*
+ *  FastPin.h
+ * 
+ *  This file is part of CommandStation.
+ *
+ *  CommandStation is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  CommandStation is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with CommandStation.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef COMMANDSTATION_BOARDS_FASTPIN_H_
+#define COMMANDSTATION_BOARDS_FASTPIN_H_
+
+#include <Arduino.h>
+
+#if defined(ARDUINO_ARCH_SAMD) || defined(ARDUINO_ARCH_SAMC)
+#define FAST_PIN_SAM
+#elif defined(ARDUINO_ARCH_MEGAAVR)
+#define FAST_PIN_MEGAAVR
+#elif defined(ARDUINO_ARCH_AVR)
+// Library DIO2.h is only compatible with AVR.
+#include <DIO2.h>
+#endif
+
+// A digital pin looked up once. attach() finds the pin's port and mask, 
+// after which write() and read() are a single register access with no 
+// table lookups or checks. Set and clear registers make writes safe against 
+// interrupts touching other pins of the same port. Classic AVR keeps using 
+// DIO2, which is already fast. All zeros is a valid unattached pin; it must 
+// be attached before use.
+struct FastPin {
+  // Only looks the pin up, pinMode is still needed
+  void attach(uint8_t pin) {
+#if defined(FAST_PIN_SAM)
+    port = &PORT->Group[g_APinDescription[pin].ulPort];
+    mask = 1ul << g_APinDescription[pin].ulPin;
+#elif defined(FAST_PIN_MEGAAVR)
+    port = digitalPinToPortStruct(pin);
+    mask = digitalPinToBitMask(pin);
+#else
+    number = pin;
+#endif
+  }
+
+  inline void write(bool level) {
+#if defined(FAST_PIN_SAM)
+    if(level) port->OUTSET.reg = mask;
+    else port->OUTCLR.reg = mask;
+#elif defined(FAST_PIN_MEGAAVR)
+    if(level) port->OUTSET = mask;
+    else port->OUTCLR = mask;
+#elif defined(ARDUINO_ARCH_AVR)
+    digitalWrite2(number, level);
+#else
+    digitalWrite(number, level);
+#endif
+  }
+
+  inline bool read() const {
+#if defined(FAST_PIN_SAM)
+    return (port->IN.reg & mask) != 0;
+#elif defined(FAST_PIN_MEGAAVR)
+    return (port->IN & mask) != 0;
+#elif defined(ARDUINO_ARCH_AVR)
+    return digitalRead2(number);
+#else
+    return digitalRead(number);
+#endif
+  }
+
+private:
+#if defined(FAST_PIN_SAM)
+  PortGroup* port;
+  uint32_t mask;
+#elif defined(FAST_PIN_MEGAAVR)
+  PORT_t* port;
+  uint8_t mask;
+#else
+  uint8_t number;
+#endif
+};
+
+#endif  // COMMANDSTATION_BOARDS_FASTPIN_H_
@@ -0,0 +1,212 @@
+/*
+ *  MotorShieldBoard.h
+ * 
+ *  This file is part of CommandStation.
+ *
+ *  CommandStation is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  CommandStation is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with CommandStation.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef COMMANDSTATION_BOARDS_MOTORSHIELDBOARD_H_
+#define COMMANDSTATION_BOARDS_MOTORSHIELDBOARD_H_
+
+#include "Board.h"
+
+// Policies a MotorShieldBoard is built from. Each one is a struct of static
+// members, so the choices are made at compile time.
+
+// Pin polarity: the level of signal_b_pin during a railcom cutout. It rests
+// at the other level.
+struct CutoutActiveHigh {
+  static const uint8_t kCutoutLevel = HIGH;
+};
+struct CutoutActiveLow {
+  static const uint8_t kCutoutLevel = LOW;
+};
+
+// Current sense scaling, and the trip currents that go with it. Used for 
+// the default config, the config can still be calibrated at run time.
+template<uint32_t MicroampsPerVolt, uint16_t TripMilliamps, 
+  uint16_t FastTripMilliamps>
+struct CurrentSense {
+  static constexpr float kAmpsPerVolt = MicroampsPerVolt / 1000000.0;
+  static const uint16_t kTripMilliamps = TripMilliamps;
+  static const uint16_t kFastTripMilliamps = FastTripMilliamps;
+};
+
+// Current limit behaviour of shields with no current limiting of their own. 
+// In programming mode the trip current drops to current_trip_prog, at first 
+// for prog_trip_time after the power comes on and then for good once the 
+// timer has been passed.
+struct SoftwareCurrentLimit {
+  static void progMode(const BoardConfig& config, bool on) {
+    (void)config;
+    (void)on;
+  }
+
+  static bool isLimiting(BoardConfig& config, bool inProgMode, 
+    uint16_t progOverloadTimer) {
+    // Protect against wrapping
+    if(millis() - progOverloadTimer > config.prog_trip_time) 
+      config.prog_trip_time = 0;
+    return inProgMode && ((millis() - progOverloadTimer < 
+      config.prog_trip_time) || config.prog_trip_time == 0);
+  }
+};
+
+// A motor shield with an enable pin, a direction pin, a brake pin used for 
+// railcom cutouts and an analog current sense pin. Shields only differ in 
+// their policies and default pins, see MotorShields.h.
+template<class Polarity, class Sense, class Limit>
+class MotorShieldBoard : public Board
+{
+public:
+  BoardConfig config;
+
+  MotorShieldBoard(const BoardConfig& _config) {
+    config = _config;
+  }
+
+  // Fills in everything but the pins and the track name
+  static void getDefaultConfig(BoardConfig& _config) {
+    _config.board_voltage = 5.0;
+    _config.amps_per_volt = Sense::kAmpsPerVolt;
+    _config.current_trip = Sense::kTripMilliamps;
+    _config.current_trip_fast = Sense::kFastTripMilliamps;
+    _config.current_trip_prog = 250;
+    _config.prog_trip_time = 100;
+    _config.main_preambles = 16;
+    _config.prog_preambles = 22;
+    _config.reverser = false;
+    _config.track_power_callback = nullptr; // Needs to be set in the main file
+  }
+
+  // Changes the trip currents (mA) once the board has been set up
+  void setTripCurrents(uint16_t trip, uint16_t progTrip) {
+    config.current_trip = trip;
+    config.current_trip_prog = progTrip;
+    setTripLevels(config);
+  }
+
+  void setup() {
+    pinMode(config.enable_pin, OUTPUT);
+    enablePin.attach(config.enable_pin);
+    enablePin.write(LOW);
+
+    pinMode(config.signal_a_pin, OUTPUT);
+    signalPin.attach(config.signal_a_pin);
+    signalPin.write(LOW);
+
+    pinMode(config.signal_b_pin, OUTPUT);
+    cutoutPin.attach(config.signal_b_pin);
+    cutoutLevel = Polarity::kCutoutLevel;
+    cutout(false);
+
+    pinMode(config.sense_pin, INPUT);
+    senseChannel = CurrentSampler::addPin(config.sense_pin);
+    CurrentSampler::begin();
+    setCurrentScale(config);
+    CurrentSampler::setFastTrip(senseChannel, 
+      milliampsToCounts(config.current_trip_fast), config.enable_pin);
+    CurrentSampler::setReverser(senseChannel, config.reverser, 
+      config.signal_a_pin);
+
+    tripped = false;
+  }
+
+  const char* getName() { return config.track_name; }
+
+  void power(bool on, bool announce) {
+    if(inProgMode) {
+      progOverloadTimer = millis();
+    }
+
+    enablePin.write(on);
+
+    if(announce) {
+      config.track_power_callback(config.track_name, on);
+    }
+  }
+
+  void progMode(bool on) {
+    inProgMode = on;
+    Limit::progMode(config, on);
+  }
+
+  uint16_t getCurrentRaw() {
+    return CurrentSampler::latest(senseChannel);
+  }
+
+  uint16_t getCurrentMilliamps() {
+    return countsToMilliamps(getCurrentRaw());
+  }
+
+  uint16_t getCurrentMilliamps(uint16_t reading) {
+    return countsToMilliamps(reading);
+  }
+
+  uint16_t setCurrentBase() {
+    currentBase = getCurrentMilliamps();
+    return currentBase;
+  }
+
+  uint16_t getCurrentBase() { return currentBase; }
+
+  bool getStatus() {
+    return enablePin.read();
+  }
+
+  uint8_t getEnablePin() { return config.enable_pin; }
+
+  void checkOverload() {
+    CurrentSampler::poll(senseChannel);
+
+    // The sampler has already cut the power, catch up with it
+    uint32_t fastTime;
+    uint16_t fastCounts;
+    if(CurrentSampler::takeFastTrip(senseChannel, fastTime, fastCounts))
+      recordTrip(kTripFast, fastTime, countsToMilliamps(fastCounts));
+
+    bool limiting = isCurrentLimiting();
+    uint16_t current_trip = limiting ? config.current_trip_prog : 
+      config.current_trip;
+
+    if(millis() - lastCheckTime > kCurrentSampleTime) {
+      lastCheckTime = millis();
+      uint16_t raw = getCurrentRaw();
+      reading = smoothReading(raw);
+      telemetry.add(raw, lastCheckTime);
+
+      if(!tripped && overloaded(raw, limiting ? progTripLevel : tripLevel) &&
+        getStatus())
+        recordTrip(kTripOverload, micros(), countsToMilliamps(raw));
+    }
+
+    if(tripped) recover(current_trip);
+  }
+
+  uint8_t getPreambles() {
+    if(inProgMode) return config.prog_preambles;
+    return config.main_preambles;
+  }
+
+private:
+  FastPin enablePin;
+
+  bool isCurrentLimiting() {
+    return Limit::isLimiting(config, inProgMode, progOverloadTimer);
+  }
+};
+
+#endif  // COMMANDSTATION_BOARDS_MOTORSHIELDBOARD_H_
@@ -0,0 +1,88 @@
+/*
+ *  MotorShields.h
+ * 
+ *  This file is part of CommandStation.
+ *
+ *  CommandStation is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  CommandStation is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with CommandStation.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef COMMANDSTATION_BOARDS_MOTORSHIELDS_H_
+#define COMMANDSTATION_BOARDS_MOTORSHIELDS_H_
+
+#include "MotorShieldBoard.h"
+
+// Supported shields. A new shield picks its policies here and gives the
+// default pins of its two channels.
+
+typedef BoardConfig BoardConfigArduinoMotorShield;
+
+class BoardArduinoMotorShield : public MotorShieldBoard<CutoutActiveHigh,
+  CurrentSense<606061, 1500, 3000>, SoftwareCurrentLimit>
+{
+public:
+  BoardArduinoMotorShield(const BoardConfig& _config) 
+    : MotorShieldBoard(_config) {}
+
+  static void getDefaultConfigA(BoardConfig& _config) {
+    getDefaultConfig(_config);
+    _config.track_name = "A";
+    _config.signal_a_pin = 12;
+    _config.signal_b_pin = 9;
+    _config.enable_pin = 3;
+    _config.sense_pin = A0;
+  }
+
+  static void getDefaultConfigB(BoardConfig& _config) {
+    getDefaultConfig(_config);
+    _config.track_name = "B";
+    _config.signal_a_pin = 13;
+    _config.signal_b_pin = 8;
+    _config.enable_pin = 11;
+    _config.sense_pin = A1;
+  }
+};
+
+typedef BoardConfig BoardConfigPololuMotorShield;
+
+class BoardPololuMotorShield : public MotorShieldBoard<CutoutActiveLow,
+  CurrentSense<1904762, 3000, 6000>, SoftwareCurrentLimit>
+{
+public:
+  BoardPololuMotorShield(const BoardConfig& _config) 
+    : MotorShieldBoard(_config) {}
+
+  static void getDefaultConfigA(BoardConfig& _config) {
+    getDefaultConfig(_config);
+    _config.track_name = "A";
+    _config.signal_a_pin = 7;
+    _config.signal_b_pin = 9;
+    _config.enable_pin = 4;
+    _config.sense_pin = A0;
+  }
+
+  // Both channels are enabled by the shield's shared D2 input on pin 4, so
+  // the two tracks can only be powered together. The power budget takes 
+  // just one of them.
+  static void getDefaultConfigB(BoardConfig& _config) {
+    getDefaultConfig(_config);
+    _config.track_name = "B";
+    _config.signal_a_pin = 8;
+    _config.signal_b_pin = 10;
+    _config.enable_pin = 4;
+    _config.sense_pin = A1;
+  }
+};
+
+#endif  // COMMANDSTATION_BOARDS_MOTORSHIELDS_H_
@@ -0,0 +1,156 @@
+/*
+ *  PowerBudget.cpp
+ * 
+ *  This file is part of CommandStation.
+ *
+ *  CommandStation is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  CommandStation is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with CommandStation.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include "PowerBudget.h"
+
+PowerBudget::Entry PowerBudget::boards[kPowerBudgetBoards];
+uint8_t PowerBudget::count = 0;
+uint16_t PowerBudget::limit = 0;
+uint16_t PowerBudget::total = 0;
+uint8_t PowerBudget::pending = 0;
+unsigned long PowerBudget::lastStagger = 0;
+unsigned long PowerBudget::lastCheck = 0;
+unsigned long PowerBudget::lastShed = 0;
+
+bool PowerBudget::addBoard(Board* board, uint8_t priority) {
+  if(hasBoard(board)) return true;
+  if(count == kPowerBudgetBoards) return false;
+  for(uint8_t i = 0; i < count; i++) 
+    if(boards[i].board->getEnablePin() == board->getEnablePin()) return false;
+
+  // Kept in priority order, boards of equal priority in the order added
+  uint8_t slot = count;
+  while(slot > 0 && boards[slot - 1].priority > priority) {
+    boards[slot] = boards[slot - 1];
+    slot--;
+  }
+  boards[slot].board = board;
+  boards[slot].priority = priority;
+  boards[slot].shed = false;
+  boards[slot].shedMilliamps = 0;
+  count++;
+  return true;
+}
+
+void PowerBudget::removeBoard(Board* board) {
+  for(uint8_t i = 0; i < count; i++) {
+    if(boards[i].board != board) continue;
+    // Pending bits follow the boards' positions
+    uint8_t below = pending & ((1 << i) - 1);
+    pending = below | ((pending >> 1) & ~((1 << i) - 1));
+    count--;
+    for(uint8_t j = i; j < count; j++) boards[j] = boards[j + 1];
+    board->hold(false);
+    return;
+  }
+}
+
+bool PowerBudget::hasBoard(Board* board) {
+  for(uint8_t i = 0; i < count; i++) 
+    if(boards[i].board == board) return true;
+  return false;
+}
+
+void PowerBudget::setLimit(uint16_t milliamps) {
+  limit = milliamps;
+}
+
+void PowerBudget::powerAll(bool on) {
+  // Held until their turn to power on, so a board that tripped earlier 
+  // doesn't recover on its own
+  for(uint8_t i = 0; i < count; i++) {
+    boards[i].shed = false;
+    boards[i].board->hold(true);
+  }
+  if(!on) {
+    pending = 0;
+    for(uint8_t i = 0; i < count; i++) boards[i].board->power(OFF, false);
+    return;
+  }
+  pending = (1 << count) - 1;
+  lastStagger = millis() - kPowerStaggerTime;
+  loop();
+}
+
+uint8_t PowerBudget::getShed() {
+  uint8_t shed = 0;
+  for(uint8_t i = 0; i < count; i++) 
+    if(boards[i].shed) shed |= 1 << i;
+  return shed;
+}
+
+// Within 90% of the limit, so a restored board doesn't get shed again
+bool PowerBudget::fits(uint16_t milliamps) {
+  return limit == 0 || (uint32_t)milliamps * 10 <= (uint32_t)limit * 9;
+}
+
+void PowerBudget::loop() {
+  if(millis() - lastCheck >= kPowerBudgetPeriod) {
+    lastCheck = millis();
+    uint32_t sum = 0;
+    for(uint8_t i = 0; i < count; i++) 
+      if(boards[i].board->getStatus()) 
+        sum += boards[i].board->getCurrentSmoothed();
+    total = sum > 0xFFFF ? 0xFFFF : sum;
+  }
+
+  // Staggered power on, held back while the supply has no room
+  if(pending != 0 && millis() - lastStagger >= kPowerStaggerTime && 
+    fits(total)) {
+    for(uint8_t i = 0; i < count; i++) {
+      if(!(pending & (1 << i))) continue;
+      pending &= ~(1 << i);
+      boards[i].board->hold(false);
+      boards[i].board->power(ON, false);
+      lastStagger = millis();
+      break;
+    }
+  }
+
+  if(limit == 0 || millis() - lastShed < kPowerShedSettle) return;
+
+  if(total > limit) {
+    for(uint8_t i = count; i-- > 0; ) {
+      Entry& entry = boards[i];
+      if(entry.shed || !entry.board->getStatus()) continue;
+      entry.shedMilliamps = entry.board->getCurrentSmoothed();
+      entry.shed = true;
+      entry.board->power(OFF, true);
+      entry.board->hold(true);
+      lastShed = millis();
+      return;
+    }
+    return;
+  }
+
+  if(millis() - lastShed < kPowerRestoreDelay) return;
+  for(uint8_t i = 0; i < count; i++) {
+    Entry& entry = boards[i];
+    if(!entry.shed) continue;
+    // Only the highest priority board is tried, so lower ones can't jump it
+    if(fits(total + entry.shedMilliamps)) {
+      entry.shed = false;
+      entry.board->hold(false);
+      entry.board->power(ON, true);
+      lastShed = millis();
+    }
+    return;
+  }
+}
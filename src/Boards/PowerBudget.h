@@ -0,0 +1,93 @@
+/*
+ *  PowerBudget.h
+ * 
+ *  This file is part of CommandStation.
+ *
+ *  CommandStation is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  CommandStation is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with CommandStation.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef COMMANDSTATION_BOARDS_POWERBUDGET_H_
+#define COMMANDSTATION_BOARDS_POWERBUDGET_H_
+
+#include <Arduino.h>
+
+#include "Board.h"
+
+// Boards that can share a supply
+const uint8_t kPowerBudgetBoards = 6;
+// Time between boards when powering everything on (millis)
+const uint16_t kPowerStaggerTime = 100;
+// Time between checks of the total current (millis)
+const uint8_t kPowerBudgetPeriod = 10;
+// Time the smoothed currents need to show the effect of shedding a board, 
+// before another one is shed (millis)
+const uint16_t kPowerShedSettle = 500;
+// Time a shed board stays off before it may come back (millis)
+const uint16_t kPowerRestoreDelay = 5000;
+
+// Keeps boards that share a supply within a total current. Powering all 
+// boards on is staggered so their inrush does not add up. When the smoothed 
+// currents of the powered boards add up to more than the limit, the lowest 
+// priority board is shed; it comes back once it fits within 90% of the limit 
+// again. Boards still trip on their own current_trip as before, but one 
+// the budget has turned off, shed or waiting to power on, is held so that 
+// its overload recovery can't turn it back on.
+//
+// The sketch adds its boards in setup and calls PowerBudget::loop() from 
+// loop() next to the tracks' loops. <0> and <1> power the boards it added
+// through powerAll, and any others directly.
+struct PowerBudget {
+  // Adds a board, priority 0 is the last to be shed and the first to be 
+  // powered on. Returns false if there is no room, or if a board already 
+  // added has the same enable pin: the two can't be powered apart, so 
+  // shedding one would cut the other.
+  static bool addBoard(Board* board, uint8_t priority);
+  static void removeBoard(Board* board);
+  static bool hasBoard(Board* board);
+  // Total current in mA, 0 turns shedding off
+  static void setLimit(uint16_t milliamps);
+  static uint16_t getLimit() { return limit; }
+
+  // Powers all boards off at once, or on one at a time in priority order
+  static void powerAll(bool on);
+  // Carries on a staggered power on and sheds or restores boards
+  static void loop();
+
+  // Total current of the powered boards at the last check, mA
+  static uint16_t getTotal() { return total; }
+  // Bit per board, in priority order
+  static uint8_t getShed();
+  static uint8_t getPending() { return pending; }
+
+private:
+  struct Entry {
+    Board* board;
+    uint8_t priority;
+    bool shed;
+    uint16_t shedMilliamps;   // Its current when it was shed
+  };
+  static Entry boards[kPowerBudgetBoards];
+  static uint8_t count;
+  static uint16_t limit;
+  static uint16_t total;
+  static uint8_t pending;     // Boards still to be powered on
+  static unsigned long lastStagger;
+  static unsigned long lastCheck;
+  static unsigned long lastShed;
+
+  static bool fits(uint16_t milliamps);
+};
+
+#endif  // COMMANDSTATION_BOARDS_POWERBUDGET_H_
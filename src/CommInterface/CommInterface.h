@@ -22,6 +22,8 @@
 
 #include <Stream.h>
 
+#include "LineAssembler.h"
+
 class CommInterface {
 public:
   virtual void process() = 0;
@@ -34,6 +36,12 @@ public:
   virtual Print* getStream() = 0;
 #endif
 
+  const LineAssemblerStats& getLineStats() const { return lines.getStats(); }
+  void setLineOverflow(LineOverflow overflow) { lines.setOverflow(overflow); }
+
+protected:
+  LineAssembler lines;
+
 };
 
 #endif	// COMMANDSTATION_COMMINTERFACE_COMMINTERFACE_H_
\ No newline at end of file
@@ -24,24 +24,16 @@
 #include "CommManager.h"
 #include "DCCEXParser.h"
 
-SerialInterface::SerialInterface(HardwareSerial &serial, long baud) : serialStream(serial), baud(baud), buffer(""), inCommandPayload(false) {
+SerialInterface::SerialInterface(HardwareSerial &serial, long baud) : serialStream(serial), baud(baud) {
   serialStream.begin(baud);
   serialStream.flush();
 }
 
 void SerialInterface::process() {
-  while(serialStream.available()) {
-    char ch = serialStream.read();
-    if (ch == '<') {
-      inCommandPayload = true;
-      buffer = "";
-    } else if (ch == '>') {
-      DCCEXParser::parse(&serialStream, buffer.c_str());
-      buffer = "";
-      inCommandPayload = false;
-    } else if(inCommandPayload) {
-      buffer += ch;
-    }
+  for(uint8_t budget = kLineBytesPerCall; 
+    budget > 0 && serialStream.available(); budget--) {
+    if(lines.add(serialStream.read())) 
+      DCCEXParser::parse(&serialStream, lines.line());
   }
 }
 
@@ -35,8 +35,6 @@ public:
 protected:
 	HardwareSerial &serialStream;
 	long baud;
-	String buffer;
-	bool inCommandPayload;
 };
 
 #endif	// COMMANDSTATION_COMMINTERFACE_COMMINTERFACESERIAL_H_
\ No newline at end of file
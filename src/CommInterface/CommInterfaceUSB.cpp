@@ -26,24 +26,16 @@
 #include "CommManager.h"
 #include "DCCEXParser.h"
 
-USBInterface::USBInterface(Serial_ &serial, long baud) : serialStream(serial), baud(baud), buffer(""), inCommandPayload(false) {
+USBInterface::USBInterface(Serial_ &serial, long baud) : serialStream(serial), baud(baud) {
 	serialStream.begin(baud);
 	serialStream.flush();
 }
 
 void USBInterface::process() {
-	while(serialStream.available()) {
-		char ch = serialStream.read();
-		if (ch == '<') {
-			inCommandPayload = true;
-			buffer = "";
-		} else if (ch == '>') {
-			DCCEXParser::parse(&serialStream, buffer.c_str());
-			buffer = "";
-			inCommandPayload = false;
-		} else if(inCommandPayload) {
-			buffer += ch;
-		}
+	for(uint8_t budget = kLineBytesPerCall; 
+		budget > 0 && serialStream.available(); budget--) {
+		if(lines.add(serialStream.read())) 
+			DCCEXParser::parse(&serialStream, lines.line());
 	}
 }
 
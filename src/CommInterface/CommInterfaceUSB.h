@@ -35,8 +35,6 @@ public:
 protected:
 	Serial_ &serialStream;
 	long baud;
-	String buffer;
-	bool inCommandPayload;
 };
 
 #endif	// COMMANDSTATION_COMMINTERFACE_COMMINTERFACEUSB_H_
\ No newline at end of file
@@ -21,15 +21,20 @@
 
 #include <Arduino.h>
 
+#include "../Diagnostics/LoopProfiler.h"
+#include "DCCEXParser.h"
+
 CommInterface *CommManager::interfaces[5] = {NULL, NULL, NULL, NULL, NULL};
 int CommManager::nextInterface = 0;
 
 void CommManager::update() {
+	LOOP_PROFILE_SCOPE(kSectionComms);
 	for(int i = 0; i < nextInterface; i++) {
 		if(interfaces[i] != NULL) {
 			interfaces[i]->process();
 		}
 	}
+	DCCEXParser::loop();
 }
 
 void CommManager::registerInterface(CommInterface *interface) {
@@ -54,6 +59,16 @@ void CommManager::showInitInfo() {
 	}
 }
 
+void CommManager::showLineStats(Print* stream) {
+	for(int i = 0; i < nextInterface; i++) {
+		if(interfaces[i] != NULL) {
+			const LineAssemblerStats& stats = interfaces[i]->getLineStats();
+			send(stream, F("<n %d %l %l %l %l>"), i, (long)stats.bytes, 
+				(long)stats.frames, (long)stats.oversized, (long)stats.dropped);
+		}
+	}
+}
+
 void CommManager::broadcast(const __FlashStringHelper* input, ...) {
   for(int i = 0; i < nextInterface; i++) {
 		if(interfaces[i] != NULL) {
@@ -44,6 +44,7 @@ public:
   static void registerInterface(CommInterface *interface);
   static void showConfiguration();
   static void showInitInfo();
+  static void showLineStats(Print* stream);
   static void broadcast(const __FlashStringHelper* input, ...);
   static void print(const __FlashStringHelper* input, ...);
   static void send(Print* stream, const __FlashStringHelper* input, ...);
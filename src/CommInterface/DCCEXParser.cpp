@@ -25,19 +25,32 @@
 #include "../Accessories/Outputs.h"
 #include "../Accessories/Sensors.h"
 #include "../Accessories/Turnouts.h"
+#include "../Boards/PowerBudget.h"
 #include "../DCC-EX-Lib.h"
+#include "../Diagnostics/LoopProfiler.h"
 #include "CommManager.h"
 
 DCCMain* DCCEXParser::mainTrack;
 DCCService* DCCEXParser::progTrack;
 
 int DCCEXParser::p[MAX_PARAMS];
+DCCEXParser::TelemetrySubscriber 
+  DCCEXParser::subscribers[kTelemetrySubscribers];
 
 void DCCEXParser::init(DCCMain* mainTrack_, DCCService* progTrack_) {
   mainTrack = mainTrack_;
   progTrack = progTrack_;
 } 
 
+// Boards the sketch added to the power budget are powered by it, the rest
+// directly
+void DCCEXParser::powerTracks(bool on) {
+  PowerBudget::powerAll(on);
+  Board* boards[] = {mainTrack->board, progTrack->board};
+  for(Board* board : boards)
+    if(!PowerBudget::hasBoard(board)) board->power(on, false);
+}
+
 int DCCEXParser::stringParser(const char *com, int result[]) {
   byte state=1;
   byte parameterCount=0;
@@ -251,25 +264,197 @@ void DCCEXParser::parse(Print* stream, const char *com) {
 
 /***** WRITE CONFIGURATION VARIABLE BYTE TO ENGINE DECODER ON PROG TRACK  ****/
 
-  case 'W':      // <W CV VALUE CALLBACKNUM CALLBACKSUB>
+  case 'W': {    // <W CV VALUE CALLBACKNUM CALLBACKSUB [IFDIFFERENT]>
+    serviceJobResponse response;
+
+    jobResponse(stream, progTrack->writeCVByte(p[0], p[1], p[2], p[3], stream, 
+      cvResponse, response, kServicePriorityNormal, numArgs == 5 && p[4] == 1), 
+      response, WRITECV, p[0], 0, p[2], p[3]);
+
+    break;
+  }
 
-    progTrack->writeCVByte(p[0], p[1], p[2], p[3], stream, cvResponse);
+/***** BUILD AND RUN A PROGRAMMING SESSION ON PROG TRACK  ****/
 
+  // A decoder profile is a session of write-if-different operations
+  case 'P': {   // <P [0 | 1 CALLBACKNUM CALLBACKSUB | 2 CV VALUE ... | 
+                //     3 CV ... | 4 CV VALUE ...]>
+    if(numArgs == 1 && p[0] == 0) {
+      progTrack->clearSession();
+      CommManager::send(stream, 
+        progTrack->getSessionLength() == 0 ? F("<O>") : F("<X>"));
+      break;
+    }
+    if(numArgs == 3 && p[0] == 1) {
+      serviceJobResponse response;
+      jobResponse(stream, progTrack->runSession(p[1], p[2], stream, 
+        cvResponse, response), response, READCV, 0, 0, p[1], p[2]);
+      break;
+    }
+    if(numArgs >= 2 && p[0] == 3) {       // Reads
+      bool added = true;
+      for(int i = 1; i < numArgs && added; i++) 
+        added = progTrack->addSessionOp(kSessionRead, p[i]);
+      if(!added) {
+        CommManager::send(stream, F("<X>"));
+        break;
+      }
+    }
+    if(numArgs >= 3 && numArgs % 2 == 1 && (p[0] == 2 || p[0] == 4)) {
+      SessionOpKind kind = p[0] == 2 ? kSessionWriteIfDifferent : kSessionWrite;
+      bool added = true;
+      for(int i = 1; i < numArgs && added; i += 2) 
+        added = progTrack->addSessionOp(kind, p[i], p[i+1]);
+      if(!added) {
+        CommManager::send(stream, F("<X>"));
+        break;
+      }
+    }
+    // <y LENGTH DONE WRITTEN SKIPPED FAILED>
+    sessionStatusResponse status;
+    progTrack->getSessionStatus(status);
+    CommManager::send(stream, F("<y %d %d %d %d %d>"), status.length, 
+      status.done, status.written, status.skipped, status.failed);
     break;
+  }
 
 /***** WRITE CONFIGURATION VARIABLE BIT TO ENGINE DECODER ON PROG TRACK  ****/
 
-  case 'B':      // <B CV BIT VALUE CALLBACKNUM CALLBACKSUB>
+  case 'B': {    // <B CV BIT VALUE CALLBACKNUM CALLBACKSUB>
+    serviceJobResponse response;
     
-    progTrack->writeCVBit(p[0], p[1], p[2], p[3], p[4], stream, cvResponse);
+    jobResponse(stream, progTrack->writeCVBit(p[0], p[1], p[2], p[3], p[4], 
+      stream, cvResponse, response), response, WRITECVBIT, p[0], p[1], p[3], 
+      p[4]);
     
     break;
+  }
 
 /***** READ CONFIGURATION VARIABLE BYTE FROM ENGINE DECODER ON PROG TRACK  ****/
 
-  case 'R':     // <R CV CALLBACKNUM CALLBACKSUB>        
-    progTrack->readCV(p[0], p[1], p[2], stream, cvResponse);
+  case 'R': {   // <R CV CALLBACKNUM CALLBACKSUB [PREDICTED [CACHEMODE]]>
+    serviceJobResponse response;
+    uint8_t result;
+
+    // A PREDICTED of -1 means none, so that CACHEMODE can be given alone
+    if(numArgs >= 4 && p[3] >= 0) 
+      result = progTrack->readCVPredicted(p[0], p[3], p[1], p[2], stream, 
+        cvResponse, response);
+    else if(numArgs == 5 && p[4] >= kCacheBypass && p[4] <= kCacheTrust)
+      result = progTrack->readCV(p[0], p[1], p[2], stream, cvResponse, 
+        response, kServicePriorityNormal, (CVCacheMode)p[4]);
+    else
+      result = progTrack->readCV(p[0], p[1], p[2], stream, cvResponse, 
+        response);
+    jobResponse(stream, result, response, READCV, p[0], 0, p[1], p[2]);
+
+    break;
+  }
+
+/***** IDENTIFY THE DECODER ON PROG TRACK  ****/
+
+  case 'I': {   // <I CALLBACKNUM CALLBACKSUB>
+    serviceJobResponse response;
+    if(progTrack->identifyDecoder(p[0], p[1], stream, identifyResponse, 
+      response) == ERR_OK) {
+      CommManager::send(stream, F("<j %d %d>"), response.jobID, 
+        response.position);
+      break;
+    }
+
+    // Queue full or already identifying
+    decoderIdentityResponse identity;
+    identity.callback = p[0];
+    identity.callbackSub = p[1];
+    identity.manufacturer = identity.version = identity.config = 
+      identity.address = -1;
+    identifyResponse(stream, identity);
+    break;
+  }
+
+/***** BACK UP DECODER CVS ON PROG TRACK  ****/
+
+  case 'V': {   // <V FIRSTCV LASTCV CALLBACKNUM CALLBACKSUB>
+    serviceJobResponse response;
+    if(progTrack->backupCVs(p[0], p[1], p[2], p[3], stream, backupResponse,
+      response) == ERR_OK) {
+      CommManager::send(stream, F("<j %d %d>"), response.jobID, 
+        response.position);
+      break;
+    }
+
+    // Busy, nothing was read so resume from the start
+    backupFrameResponse frame;
+    frame.callback = p[2];
+    frame.callbackSub = p[3];
+    frame.firstCV = p[0];
+    frame.count = 0;
+    backupResponse(stream, frame);
+    break;
+  }
+
+/***** RESTORE DECODER CVS ON PROG TRACK  ****/
+
+  case 'D': {   // <D [0 | 1 CALLBACKNUM CALLBACKSUB | 2 CV VALUE ...]>
+    if(numArgs == 1 && p[0] == 0) progTrack->endRestore();
+    if(numArgs == 3 && p[0] == 1) {
+      serviceJobResponse response;
+      jobResponse(stream, progTrack->restoreCVs(p[1], p[2], stream, 
+        cvResponse, response), response, WRITECV, 0, 0, p[1], p[2]);
+      break;
+    }
+    if(numArgs >= 3 && numArgs % 2 == 1 && p[0] == 2) {
+      // All or nothing, so the client can simply send the frame again
+      if(progTrack->getRestoreSpace() < numArgs / 2) {
+        CommManager::send(stream, F("<X>"));
+        break;
+      }
+      for(int i = 1; i < numArgs; i += 2) 
+        progTrack->addRestoreCV(p[i], p[i+1]);
+    }
+    // <z BUFFERED DONE WRITTEN SKIPPED FAILED TIMED_OUT>
+    restoreStatusResponse status;
+    progTrack->getRestoreStatus(status);
+    CommManager::send(stream, F("<z %d %d %d %d %d %d>"), status.buffered, 
+      status.done, status.written, status.skipped, status.failed, 
+      status.timedOut);
+    break;
+  }
+
+/***** SELECT THE DECODER CACHED BY PROGRAMMING TRACK JOBS  ****/
 
+  case 'K':     // <K [MANUFACTURER VERSION ADDRESS | 0]>
+    if(numArgs == 3) {
+      progTrack->selectCacheDecoder(p[0], p[1], p[2]);
+      if(progTrack->getCacheDecoder() == kCVCacheNoDecoder) {
+        // No room for the cache in EEPROM
+        CommManager::send(stream, F("<X>"));
+        break;
+      }
+      // <o SLOT CACHED_CVS>
+      CommManager::send(stream, F("<o %d %d>"), progTrack->getCacheDecoder(), 
+        CVCache::count(progTrack->getCacheDecoder()));
+      break;
+    }
+    if(numArgs == 1 && p[0] == 0) CVCache::clear();
+    progTrack->clearCacheDecoder();
+    CommManager::send(stream, F("<O>"));
+    break;
+
+/***** LIST OR CANCEL PROGRAMMING TRACK JOBS  ****/
+
+  case 'J':     // <J [JOBID]>
+    if(numArgs == 1) {
+      CommManager::send(stream, 
+        progTrack->cancelJob(p[0]) ? F("<O>") : F("<X>"));
+      break;
+    }
+    // <j JOBID POSITION CV> for each job, the running one first
+    for(uint8_t i = 0; i < progTrack->jobCount(); i++) {
+      uint16_t jobID, cv;
+      if(!progTrack->getJob(i, jobID, cv)) break;
+      CommManager::send(stream, F("<j %d %d %d>"), jobID, i, cv);
+    }
     break;
 
 /***** READ CONFIGURATION VARIABLE BYTE FROM RAILCOM DECODER ON MAIN TRACK ****/
@@ -292,16 +477,14 @@ void DCCEXParser::parse(Print* stream, const char *com) {
 /***** TURN ON POWER FROM MOTOR SHIELD TO TRACKS  ****/
 
   case '1':      // <1>
-    mainTrack->board->power(true, false);
-    progTrack->board->power(true, false);
+    powerTracks(ON);
     CommManager::broadcast(F("<p1>"));
     break;
 
 /***** TURN OFF POWER FROM MOTOR SHIELD TO TRACKS  ****/
 
   case '0':     // <0>
-    mainTrack->board->power(false, false);
-    progTrack->board->power(false, false);
+    powerTracks(OFF);
     CommManager::broadcast(F("<p0>"));
     break;
 
@@ -315,6 +498,129 @@ void DCCEXParser::parse(Print* stream, const char *com) {
     CommManager::send(stream, F("<a %d>"), currRead);
     break;
 
+/***** REPORT OR SET THE SHARED POWER BUDGET  ****/
+
+  case 'M':     // <M [LIMIT]>
+    if(numArgs == 1) {
+      // Total mA of all boards, 0 turns shedding off. Read again as a long,
+      // since p[] is too small for every limit on AVR.
+      long limit = strtol(com + 1, NULL, 10);
+      if(limit < 0 || limit > 0xFFFF) {
+        CommManager::send(stream, F("<X>"));
+        break;
+      }
+      PowerBudget::setLimit(limit);
+      CommManager::send(stream, F("<O>"));
+      break;
+    }
+    // <m TOTAL LIMIT SHED PENDING>, one bit per board in priority order
+    CommManager::send(stream, F("<m %l %l %d %d>"), 
+      (long)PowerBudget::getTotal(), (long)PowerBudget::getLimit(), 
+      PowerBudget::getShed(), PowerBudget::getPending());
+    break;
+
+/***** REPORT, SUBSCRIBE TO OR UNSUBSCRIBE FROM CURRENT TELEMETRY  ****/
+
+  case 'C':     // <C [PERIOD | -1]>
+    if(numArgs == 0) {
+      telemetryReport(stream);
+      break;
+    }
+    if(p[0] == -1) {
+      historyReport(stream);
+      break;
+    }
+    // Pushes the <C> report every PERIOD millis, 0 stops it
+    if(p[0] < 0 || (p[0] != 0 && p[0] < kTelemetryMinPeriod) || 
+      !subscribeTelemetry(stream, p[0])) {
+      CommManager::send(stream, F("<X>"));
+      break;
+    }
+    CommManager::send(stream, F("<O>"));
+    break;
+
+/***** REPORT COMMAND INPUT STATISTICS  ****/
+
+  case 'n':     // <n>
+    // Per interface <n INTERFACE BYTES FRAMES OVERSIZED DROPPED>
+    CommManager::showLineStats(stream);
+    break;
+
+/***** REPORT MAIN TRACK BANDWIDTH USE  ****/
+
+  case 'U': {   // <U>
+    // Per second over the last window. Classes are first transmission, 
+    // repeat, refresh and idle; each reports its share of bits in permille.
+    const BandwidthReport& bandwidth = mainTrack->getBandwidth();
+    uint16_t total = bandwidth.totalBits > 0 ? bandwidth.totalBits : 1;
+    CommManager::send(stream, F("<u %d %d>"), bandwidth.windowMillis, 
+      bandwidth.totalBits);
+    for(uint8_t i = 0; i < kTrafficClasses; i++) {
+      CommManager::send(stream, F("<u c %d %d %d %d>"), i, 
+        bandwidth.byClass[i].packets, bandwidth.byClass[i].bits, 
+        (int)((uint32_t)bandwidth.byClass[i].bits * 1000 / total));
+    }
+    for(uint8_t i = 0; i < kPacketTypes; i++) {
+      if(bandwidth.byType[i].packets == 0) continue;
+      CommManager::send(stream, F("<u t %d %d %d>"), i, 
+        bandwidth.byType[i].packets, bandwidth.byType[i].bits);
+    }
+    break;
+  }
+
+/***** REPORT OR RESET WAVEFORM ISR TIMING  ****/
+
+  case 'L':     // <L [0]>
+#if defined(DCC_ISR_STATS)
+    if(numArgs == 1 && p[0] == 0) {
+      noInterrupts();
+      mainTrack->isrStats.reset();
+      progTrack->isrStats.reset();
+      interrupts();
+      CommManager::send(stream, F("<O>"));
+      break;
+    }
+    isrStatsReport(stream, mainTrack->board->getName(), mainTrack->isrStats);
+    isrStatsReport(stream, progTrack->board->getName(), progTrack->isrStats);
+#else
+    CommManager::send(stream, F("<X>"));
+#endif
+    break;
+
+/***** REPORT MAIN LOOP PROFILE, RESET IT OR SET A BUDGET  ****/
+
+  case 'G':     // <G [0 | SECTION BUDGET]>
+#if defined(DCC_LOOP_PROFILE)
+    if(numArgs == 1 && p[0] == 0) {
+      LoopProfiler::reset();
+      CommManager::send(stream, F("<O>"));
+      break;
+    }
+    if(numArgs == 2) {
+      if(p[0] < 0 || p[0] >= kLoopSections || p[1] <= 0) {
+        CommManager::send(stream, F("<X>"));
+        break;
+      }
+      LoopProfiler::setBudget((LoopSection)p[0], p[1]);
+      CommManager::send(stream, F("<O>"));
+      break;
+    }
+    // <g LOOPS/S OVERRUN_FLAGS>, then per section (micros)
+    // <g SECTION COUNT MEAN MAX P99 BUDGET OVERRUNS>
+    CommManager::send(stream, F("<g %l %d>"), 
+      (long)LoopProfiler::getLoopRate(), LoopProfiler::takeOverrunFlags());
+    for(uint8_t i = 0; i < kLoopSections; i++) {
+      const LoopSectionStats& section = LoopProfiler::getStats((LoopSection)i);
+      CommManager::send(stream, F("<g %d %l %l %l %l %l %l>"), i, 
+        (long)section.time.count, (long)section.time.mean(), 
+        (long)section.time.max, (long)section.time.percentile(99), 
+        (long)section.budget, (long)section.overruns);
+    }
+#else
+    CommManager::send(stream, F("<X>"));
+#endif
+    break;
+
 /***** READ STATUS OF DCC++ BASE STATION  ****/
 
   case 's':      // <s>
@@ -369,10 +675,130 @@ void DCCEXParser::cvResponse(Print* stream, serviceModeResponse response) {
   }
 }
 
+void DCCEXParser::identifyResponse(Print* stream, 
+  decoderIdentityResponse response) {
+  // <d CALLBACKNUM|CALLBACKSUB ADDRESS MANUFACTURER VERSION CV29>
+  CommManager::send(stream, F("<d%d|%d %d %d %d %d>"), response.callback,
+    response.callbackSub, response.address, response.manufacturer, 
+    response.version, response.config);
+}
+
+void DCCEXParser::backupResponse(Print* stream, backupFrameResponse frame) {
+  // <v CALLBACKNUM|CALLBACKSUB FIRSTCV VALUE ...>, without values at the end
+  CommManager::send(stream, F("<v%d|%d %d"), frame.callback, 
+    frame.callbackSub, frame.firstCV);
+  for(uint8_t i = 0; i < frame.count; i++) 
+    CommManager::send(stream, F(" %d"), frame.values[i]);
+  CommManager::send(stream, F(">"));
+}
+
+void DCCEXParser::jobResponse(Print* stream, uint8_t result, 
+  serviceJobResponse& job, cv_edit_type type, int cv, int bitNum, 
+  int callback, int callbackSub) {
+  if(result == ERR_OK) {
+    CommManager::send(stream, F("<j %d %d>"), job.jobID, job.position);
+    return;
+  }
+
+  // Queue full, fail the request straight away
+  serviceModeResponse response;
+  response.type = type;
+  response.cv = cv;
+  response.cvBitNum = bitNum;
+  response.cvValue = -1;
+  response.callback = callback;
+  response.callbackSub = callbackSub;
+  cvResponse(stream, response);
+}
+
+#if defined(DCC_ISR_STATS)
+void DCCEXParser::isrStatsReport(Print* stream, const char* name, 
+  IsrStats& stats) {
+  for(uint8_t kind = 0; kind < kIsrStatsKinds; kind++) {
+    TimingHistogram h;
+    noInterrupts();
+    h = stats.histograms[kind];
+    interrupts();
+
+    // <l TRACK KIND COUNT MIN MAX MEAN>, then the log2 buckets
+    CommManager::send(stream, F("<l %s %d %l %l %l %l>"), name, kind, 
+      (long)h.count, (long)(h.count ? h.min : 0), (long)h.max, (long)h.mean());
+    CommManager::send(stream, F("<l %s %d h"), name, kind);
+    for(uint8_t i = 0; i < kHistogramBuckets; i++) 
+      CommManager::send(stream, F(" %l"), (long)h.buckets[i]);
+    CommManager::send(stream, F(">"));
+  }
+}
+#endif
+
 void DCCEXParser::POMResponse(Print* stream, RailcomPOMResponse response) {
   CommManager::send(stream, F("<k %d %x>"), response.transactionID, response.data);
 }
 
+// All boards in one response, current in mA. Per board the latest reading, 
+// min, mean and max over 1s, 10s and 60s, the number of trips and the number
+// of auto reverser polarity flips:
+// <x NAME MA MIN MEAN MAX MIN MEAN MAX MIN MEAN MAX TRIPS FLIPS ...>
+void DCCEXParser::telemetryReport(Print* stream) {
+  Board* boards[] = {mainTrack->board, progTrack->board};
+  CommManager::send(stream, F("<x"));
+  for(Board* board : boards) {
+    boardTripEvent trip;
+    CommManager::send(stream, F(" %s %d"), board->getName(), 
+      board->getCurrentMilliamps());
+    for(uint8_t i = 0; i < kCurrentWindows; i++) {
+      CurrentWindowStats stats = board->getCurrentWindow((CurrentWindow)i);
+      CommManager::send(stream, F(" %d %d %d"), stats.min, stats.mean, 
+        stats.max);
+    }
+    CommManager::send(stream, F(" %d %d"), board->getLastTrip(trip), 
+      board->getPolarityFlips());
+  }
+  CommManager::send(stream, F(">"));
+}
+
+// One second means in mA, oldest first: <h NAME COUNT MA... ...>
+void DCCEXParser::historyReport(Print* stream) {
+  Board* boards[] = {mainTrack->board, progTrack->board};
+  CommManager::send(stream, F("<h"));
+  for(Board* board : boards) {
+    uint16_t history[kTelemetrySeconds];
+    uint8_t count = board->getCurrentHistory(history);
+    CommManager::send(stream, F(" %s %d"), board->getName(), count);
+    for(uint8_t i = 0; i < count; i++) 
+      CommManager::send(stream, F(" %d"), history[i]);
+  }
+  CommManager::send(stream, F(">"));
+}
+
+bool DCCEXParser::subscribeTelemetry(Print* stream, uint16_t period) {
+  TelemetrySubscriber* slot = NULL;
+  for(TelemetrySubscriber& subscriber : subscribers) {
+    if(subscriber.stream == stream) {
+      if(period == 0) subscriber.stream = NULL;
+      subscriber.period = period;
+      return true;
+    }
+    if(subscriber.stream == NULL && slot == NULL) slot = &subscriber;
+  }
+  if(period == 0) return true;
+  if(slot == NULL) return false;
+  slot->stream = stream;
+  slot->period = period;
+  slot->lastSent = millis();
+  return true;
+}
+
+void DCCEXParser::loop() {
+  if(mainTrack == NULL || progTrack == NULL) return;
+  for(TelemetrySubscriber& subscriber : subscribers) {
+    if(subscriber.stream == NULL || 
+      millis() - subscriber.lastSent < subscriber.period) continue;
+    subscriber.lastSent = millis();
+    telemetryReport(subscriber.stream);
+  }
+}
+
 void DCCEXParser::trackPowerCallback(const char* name, bool status) {
   if(status) 
     CommManager::broadcast(F("<p1 %s>"), name);
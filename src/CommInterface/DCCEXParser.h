@@ -25,19 +25,55 @@
 
 #include <Arduino.h>
 
+// Streams that can have current telemetry pushed to them, and the shortest
+// period they can ask for (millis)
+const uint8_t kTelemetrySubscribers = 5;
+const uint16_t kTelemetryMinPeriod = 100;
+
+// Replies by their first letter, and the commands that send them:
+//   <O> <X>  success and failure of most commands
+//   <N>      interface banner at startup
+//   <T> t    <H> T s    <Y> Z s    <Q> <q> Q S and sensor changes
+//   <p> 0 1 s           <a> c      <i> s      <e> E
+//   <r> W B R           <d> I      <v> V      <j> I V J
+//   <y> P    <z> D      <o> K      <k> r m    <m> M
+//   <n> n    <u> U      <l> L      <g> G      <x> C      <h> C -1
+// <C> answers with x as c is already the main track current command.
 struct DCCEXParser
 {
   static DCCMain *mainTrack;
   static DCCService *progTrack;
   static void init(DCCMain* mainTrack_, DCCService* progTrack_);
   static void parse(Print* stream, const char *);
+  // Pushes current telemetry to subscribed streams, called by CommManager
+  static void loop();
   static void cvResponse(Print* stream, serviceModeResponse response);
+  static void identifyResponse(Print* stream, 
+    decoderIdentityResponse response);
+  static void backupResponse(Print* stream, backupFrameResponse frame);
   static void POMResponse(Print* stream, RailcomPOMResponse response);
   static void trackPowerCallback(const char* name, bool status);
 private:
   static int stringParser(const char * com, int result[]);
+  static void powerTracks(bool on);
+  static void jobResponse(Print* stream, uint8_t result, 
+    serviceJobResponse& job, cv_edit_type type, int cv, int bitNum, 
+    int callback, int callbackSub);
+  static void telemetryReport(Print* stream);
+  static void historyReport(Print* stream);
+  static bool subscribeTelemetry(Print* stream, uint16_t period);
+#if defined(DCC_ISR_STATS)
+  static void isrStatsReport(Print* stream, const char* name, IsrStats& stats);
+#endif
   static const int MAX_PARAMS=10; 
   static int p[MAX_PARAMS];
+
+  struct TelemetrySubscriber {
+    Print* stream;
+    uint16_t period;
+    unsigned long lastSent;
+  };
+  static TelemetrySubscriber subscribers[kTelemetrySubscribers];
 };
 
 #endif  // COMMANDSTATION_COMMINTERFACE_DCCEXPARSER_H_
\ No newline at end of file
@@ -0,0 +1,48 @@
+/*
+ *  LineAssembler.cpp
+ * 
+ *  This file is part of CommandStation.
+ *
+ *  CommandStation is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  CommandStation is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with CommandStation.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include "LineAssembler.h"
+
+bool LineAssembler::add(char ch) {
+  stats.bytes++;
+  if(ch == '<') {
+    if(inFrame) stats.dropped++;
+    inFrame = true;
+    overflowed = false;
+    length = 0;
+    return false;
+  }
+  if(!inFrame) return false;
+
+  if(ch == '>') {
+    inFrame = false;
+    buffer[length] = '\0';
+    if(overflowed) {
+      stats.oversized++;
+      if(policy == kLineDropFrame) return false;
+    }
+    stats.frames++;
+    return true;
+  }
+
+  if(length < kLineCapacity) buffer[length++] = ch;
+  else overflowed = true;
+  return false;
+}
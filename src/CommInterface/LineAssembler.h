@@ -0,0 +1,70 @@
+/*
+ *  LineAssembler.h
+ * 
+ *  This file is part of CommandStation.
+ *
+ *  CommandStation is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  CommandStation is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with CommandStation.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef COMMANDSTATION_COMMINTERFACE_LINEASSEMBLER_H_
+#define COMMANDSTATION_COMMINTERFACE_LINEASSEMBLER_H_
+
+#include <Arduino.h>
+
+// Longest command kept, between the brackets. Fits ten parameters.
+const uint8_t kLineCapacity = 80;
+// Bytes an interface reads per call to process(), so a flood of input can't 
+// hold up the main loop. One AVR receive buffer's worth.
+const uint8_t kLineBytesPerCall = 64;
+
+// What happens to a command longer than kLineCapacity
+enum LineOverflow : uint8_t {
+  kLineDropFrame,   // Discard it
+  kLineTruncate,    // Pass on the first kLineCapacity characters
+};
+
+struct LineAssemblerStats {
+  uint32_t bytes;       // Bytes received
+  uint16_t frames;      // Commands passed on
+  uint16_t oversized;   // Commands longer than kLineCapacity
+  uint16_t dropped;     // Commands cut short by a new '<'
+};
+
+// Assembles <...> commands one byte at a time into a fixed buffer, without
+// any heap allocation. Bytes outside brackets are ignored.
+class LineAssembler {
+public:
+  LineAssembler() : length(0), inFrame(false), overflowed(false), 
+    policy(kLineDropFrame), stats() {}
+
+  void setOverflow(LineOverflow overflow) { policy = overflow; }
+
+  // Returns true when ch completes a command, which line() then holds 
+  // until the next call
+  bool add(char ch);
+  const char* line() const { return buffer; }
+
+  const LineAssemblerStats& getStats() const { return stats; }
+
+private:
+  char buffer[kLineCapacity + 1];
+  uint8_t length;
+  bool inFrame;
+  bool overflowed;
+  LineOverflow policy;
+  LineAssemblerStats stats;
+};
+
+#endif  // COMMANDSTATION_COMMINTERFACE_LINEASSEMBLER_H_
@@ -25,6 +25,7 @@
 #include "CommInterface/DCCEXParser.h"
 #include "DCC/DCCMain.h"
 #include "DCC/DCCService.h"
+#include "Diagnostics/LoopProfiler.h"
 
 #include "CommInterface/CommInterfaceSerial.h"
 #if defined (ARDUINO_ARCH_SAMD)
@@ -32,8 +33,8 @@
 #endif
 
 // Motor board includes
-#include "Boards/BoardArduinoMotorShield.h"
-#include "Boards/BoardPololuMotorShield.h"
+#include "Boards/MotorShields.h"
+#include "Boards/PowerBudget.h"
 
 #define VERSION "1.0.0"
 #define BOARD_NAME "DCC++ CommandStation"
@@ -0,0 +1,195 @@
+/*
+ *  CVCache.cpp
+ * 
+ *  This file is part of CommandStation.
+ *
+ *  CommandStation is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  CommandStation is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with CommandStation.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include "CVCache.h"
+
+#include "../Accessories/EEStore.h"
+
+#if !defined(ARDUINO_ARCH_SAMD) && !defined(ARDUINO_ARCH_SAMC)
+#include <EEPROM.h>
+#endif
+
+const int kCVCacheBytes = sizeof(CVCacheHeader) 
+  + kCVCacheDecoders * sizeof(CVCacheDecoder) 
+  + kCVCacheDecoders * kCVCacheDecoderEntries * sizeof(CVCacheEntry);
+
+int CVCache::base = -1;
+
+bool CVCache::begin() {
+  // The EEStore data can grow into the cache when it's stored. That starts 
+  // with the header, so the cache is checked again once there is room.
+  long top = (long)EEPROM.length() - kCVCacheBytes;
+  if(top < EEStore::pointer()) {
+    base = -1;
+    return false;
+  }
+  if(base >= 0) return true;
+  base = top;
+
+  CVCacheHeader header;
+  EEPROM.get(base, header);
+  if(strncmp(header.id, CVCACHE_ID, sizeof(CVCACHE_ID)) != 0) clear();
+  return true;
+}
+
+int CVCache::decoderAddress(uint8_t decoder) {
+  return base + sizeof(CVCacheHeader) + decoder * sizeof(CVCacheDecoder);
+}
+
+int CVCache::entryAddress(uint8_t decoder, uint8_t entry) {
+  return base + sizeof(CVCacheHeader) 
+    + kCVCacheDecoders * sizeof(CVCacheDecoder) 
+    + (decoder * kCVCacheDecoderEntries + entry) * sizeof(CVCacheEntry);
+}
+
+void CVCache::clear() {
+  if(!begin()) return;
+
+  CVCacheHeader header;
+  sprintf(header.id, CVCACHE_ID);
+  header.nextDecoder = 0;
+  EEPROM.put(base, header);
+
+  CVCacheDecoder decoder = {0, 0, 0, 0, 0, 0, 0, 0};
+  for(uint8_t i = 0; i < kCVCacheDecoders; i++) {
+    EEPROM.put(decoderAddress(i), decoder);
+    dropDecoder(i);
+  }
+}
+
+uint8_t CVCache::select(uint8_t manufacturer, uint8_t version, 
+  uint16_t address) {
+  if(!begin()) return kCVCacheNoDecoder;
+
+  uint8_t freeSlot = kCVCacheNoDecoder;
+  for(uint8_t i = 0; i < kCVCacheDecoders; i++) {
+    CVCacheDecoder decoder;
+    EEPROM.get(decoderAddress(i), decoder);
+    if(!decoder.used) {
+      if(freeSlot == kCVCacheNoDecoder) freeSlot = i;
+      continue;
+    }
+    if(decoder.manufacturer == manufacturer && decoder.version == version
+      && decoder.address == address) return i;
+  }
+
+  if(freeSlot == kCVCacheNoDecoder) {
+    CVCacheHeader header;
+    EEPROM.get(base, header);
+    freeSlot = header.nextDecoder;
+    header.nextDecoder = (header.nextDecoder + 1) % kCVCacheDecoders;
+    EEPROM.put(base, header);
+  }
+
+  dropDecoder(freeSlot);
+  CVCacheDecoder decoder = {manufacturer, version, address, 1, 0, 0, 0, 0};
+  EEPROM.put(decoderAddress(freeSlot), decoder);
+  return freeSlot;
+}
+
+bool CVCache::getDecoder(uint8_t decoder, CVCacheDecoder& data) {
+  if(decoder >= kCVCacheDecoders || !begin()) return false;
+  EEPROM.get(decoderAddress(decoder), data);
+  return data.used;
+}
+
+void CVCache::setDecoder(uint8_t decoder, const CVCacheDecoder& data) {
+  if(decoder >= kCVCacheDecoders || !begin()) return;
+  EEPROM.put(decoderAddress(decoder), data);
+}
+
+void CVCache::dropDecoder(uint8_t decoder) {
+  CVCacheEntry entry = {kCVCacheNoCV, 0};
+  for(uint8_t i = 0; i < kCVCacheDecoderEntries; i++) 
+    EEPROM.put(entryAddress(decoder, i), entry);
+}
+
+// Returns the decoder's entry holding the CV, or -1
+int CVCache::find(uint8_t decoder, uint16_t cv) {
+  CVCacheEntry entry;
+  for(uint8_t i = 0; i < kCVCacheDecoderEntries; i++) {
+    EEPROM.get(entryAddress(decoder, i), entry);
+    if(entry.cv == cv) return i;
+  }
+  return -1;
+}
+
+bool CVCache::lookup(uint8_t decoder, uint16_t cv, uint8_t& value) {
+  if(decoder >= kCVCacheDecoders || cv == kCVCacheNoCV || !begin()) 
+    return false;
+
+  int i = find(decoder, cv);
+  if(i < 0) return false;
+  CVCacheEntry entry;
+  EEPROM.get(entryAddress(decoder, i), entry);
+  value = entry.value;
+  return true;
+}
+
+void CVCache::store(uint8_t decoder, uint16_t cv, uint8_t value) {
+  if(decoder >= kCVCacheDecoders || cv == kCVCacheNoCV || !begin()) return;
+
+  // One pass finds the CV, or else the decoder's first free entry
+  int i = -1;
+  CVCacheEntry entry;
+  for(uint8_t j = 0; j < kCVCacheDecoderEntries; j++) {
+    EEPROM.get(entryAddress(decoder, j), entry);
+    if(entry.cv == cv) {
+      // Save the EEPROM a write if nothing changed
+      if(entry.value == value) return;
+      i = j;
+      break;
+    }
+    if(entry.cv == kCVCacheNoCV && i < 0) i = j;
+  }
+  if(i < 0) {
+    // All taken, the decoder's entries are reused in turn
+    CVCacheDecoder data;
+    EEPROM.get(decoderAddress(decoder), data);
+    i = data.nextEntry % kCVCacheDecoderEntries;
+    data.nextEntry = (i + 1) % kCVCacheDecoderEntries;
+    EEPROM.put(decoderAddress(decoder), data);
+  }
+
+  entry.cv = cv;
+  entry.value = value;
+  EEPROM.put(entryAddress(decoder, i), entry);
+}
+
+void CVCache::invalidate(uint8_t decoder, uint16_t cv) {
+  if(decoder >= kCVCacheDecoders || cv == kCVCacheNoCV || !begin()) return;
+
+  int i = find(decoder, cv);
+  if(i < 0) return;
+  CVCacheEntry entry = {kCVCacheNoCV, 0};
+  EEPROM.put(entryAddress(decoder, i), entry);
+}
+
+uint8_t CVCache::count(uint8_t decoder) {
+  if(decoder >= kCVCacheDecoders || !begin()) return 0;
+
+  uint8_t n = 0;
+  CVCacheEntry entry;
+  for(uint8_t i = 0; i < kCVCacheDecoderEntries; i++) {
+    EEPROM.get(entryAddress(decoder, i), entry);
+    if(entry.cv != kCVCacheNoCV) n++;
+  }
+  return n;
+}
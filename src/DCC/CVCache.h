@@ -0,0 +1,97 @@
+/*
+ *  CVCache.h
+ * 
+ *  This file is part of CommandStation.
+ *
+ *  CommandStation is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  CommandStation is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with CommandStation.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef COMMANDSTATION_DCC_CVCACHE_H_
+#define COMMANDSTATION_DCC_CVCACHE_H_
+
+#include <Arduino.h>
+
+#define CVCACHE_ID "CVC3"
+
+const uint8_t kCVCacheDecoders = 8;
+// CVs kept per decoder. Each decoder has its own entries, so finding a CV
+// takes at most this many EEPROM reads.
+const uint8_t kCVCacheDecoderEntries = 15;
+const uint8_t kCVCacheNoDecoder = 0xFF;
+const uint16_t kCVCacheNoCV = 0;
+
+// How a programming track read uses the cache
+enum CVCacheMode : uint8_t {
+  kCacheBypass,   // Full read, the result still refreshes the cache
+  kCacheVerify,   // Verify the cached value first, full read if it's wrong
+  kCacheTrust,    // Answer from the cache without touching the track
+};
+
+struct CVCacheDecoder {
+  uint8_t manufacturer;   // CV8
+  uint8_t version;        // CV7
+  uint16_t address;
+  uint8_t used;           // 0 if the slot is free
+  // Programming track timing learned from this decoder's ACKs
+  uint8_t ackPackets;     // Most complete instruction packets before an ACK
+  uint8_t ackResets;      // Most resets after the instruction before an ACK
+  uint8_t ackCount;       // ACKs timed so far, stops counting when enough
+  uint8_t nextEntry;      // Entry reused when all of its entries are taken
+};
+
+struct CVCacheEntry {
+  uint16_t cv;            // kCVCacheNoCV if the entry is free
+  uint8_t value;
+};
+
+struct CVCacheHeader {
+  char id[sizeof(CVCACHE_ID)];
+  uint8_t nextDecoder;    // Slot reused when all are taken
+};
+
+// CV values of known decoders, kept in EEPROM above the EEStore data (at the
+// top of the device so turnouts, sensors and outputs can keep growing from the
+// bottom). Decoders are identified by manufacturer, version and address. 
+// Each has kCVCacheDecoderEntries entries of its own, reused in turn once 
+// they are all taken.
+// While the cache doesn't fit above the EEStore data it is disabled: nothing
+// is found or stored and no decoder can be selected.
+struct CVCache {
+  // Returns false if the cache is disabled
+  static bool begin();
+
+  // Returns the slot of the decoder, allocating one (and dropping the oldest
+  // decoder's CVs if needed) if it isn't known yet.
+  static uint8_t select(uint8_t manufacturer, uint8_t version, 
+    uint16_t address);
+  static bool getDecoder(uint8_t decoder, CVCacheDecoder& data);
+  static void setDecoder(uint8_t decoder, const CVCacheDecoder& data);
+
+  static bool lookup(uint8_t decoder, uint16_t cv, uint8_t& value);
+  static void store(uint8_t decoder, uint16_t cv, uint8_t value);
+  static void invalidate(uint8_t decoder, uint16_t cv);
+  // Number of CVs held for a decoder
+  static uint8_t count(uint8_t decoder);
+  static void clear();
+
+private:
+  static int base;     // -1 until begin has checked the header
+  static int decoderAddress(uint8_t decoder);
+  static int entryAddress(uint8_t decoder, uint8_t entry);
+  static int find(uint8_t decoder, uint16_t cv);
+  static void dropDecoder(uint8_t decoder);
+};
+
+#endif  // COMMANDSTATION_DCC_CVCACHE_H_
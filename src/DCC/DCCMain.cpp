@@ -27,6 +27,9 @@ DCCMain::DCCMain(uint8_t numDevices, Board* board, Railcom* railcom) {
   // Purge the queue memory
   packetQueue.clear();
 
+  memset(&traffic, 0, sizeof(traffic));
+  memset(&bandwidth, 0, sizeof(bandwidth));
+
   // Allocate memory for the speed table and clear it
   speedTable = (Speed *)calloc(numDevices, sizeof(Speed));
   for (int i = 0; i < numDevices; i++)
@@ -37,7 +40,8 @@ DCCMain::DCCMain(uint8_t numDevices, Board* board, Railcom* railcom) {
 }
 
 void DCCMain::schedulePacket(const uint8_t buffer[], uint8_t byteCount, 
-  uint8_t repeats, uint16_t identifier, PacketType type, uint16_t address) {
+  uint8_t repeats, uint16_t identifier, PacketType type, uint16_t address,
+  bool refresh) {
   
   Packet newPacket;
 
@@ -52,6 +56,7 @@ void DCCMain::schedulePacket(const uint8_t buffer[], uint8_t byteCount,
   newPacket.transmitID = identifier;
   newPacket.type = type;
   newPacket.address = address;
+  newPacket.refresh = refresh;
 
   const Packet pushPacket = newPacket;
   noInterrupts();
@@ -64,23 +69,60 @@ void DCCMain::updateSpeed() {
 
   for (; nextDev < numDevices; nextDev++) {
     if (speedTable[nextDev].cab > 0) {
-      setThrottleResponse response;
-      setThrottle(speedTable[nextDev].cab, speedTable[nextDev].speedCode, response);
+      scheduleThrottle(speedTable[nextDev].cab, speedTable[nextDev].speedCode, true);
       nextDev++;
       return;
     }
   }
   for (nextDev = 0; nextDev < numDevices; nextDev++) {
     if (speedTable[nextDev].cab > 0) {
-      setThrottleResponse response;
-      setThrottle(speedTable[nextDev].cab, speedTable[nextDev].speedCode, response);
+      scheduleThrottle(speedTable[nextDev].cab, speedTable[nextDev].speedCode, true);
       nextDev++;
       return;
     }
   }
 }
 
+void DCCMain::updateBandwidth() {
+  unsigned long now = millis();
+  unsigned long window = now - bandwidthWindowStart;
+  if(window < kBandwidthWindow) return;
+  bandwidthWindowStart = now;
+
+  Traffic counted;
+  noInterrupts();
+  counted = traffic;
+  memset(&traffic, 0, sizeof(traffic));
+  interrupts();
+
+  // Scale everything to counts per second
+  if(window > 0xFFFF) window = 0xFFFF;
+  bandwidth.windowMillis = window;
+  bandwidth.totalBits = 0;
+  for(uint8_t i = 0; i < kTrafficClasses; i++) {
+    bandwidth.byClass[i].packets = (uint32_t)counted.byClass[i].packets * 1000 / window;
+    bandwidth.byClass[i].bits = (uint32_t)counted.byClass[i].bits * 1000 / window;
+    bandwidth.totalBits += bandwidth.byClass[i].bits;
+  }
+  for(uint8_t i = 0; i < kPacketTypes; i++) {
+    bandwidth.byType[i].packets = (uint32_t)counted.byType[i].packets * 1000 / window;
+    bandwidth.byType[i].bits = (uint32_t)counted.byType[i].bits * 1000 / window;
+  }
+}
+
 uint8_t DCCMain::setThrottle(uint16_t addr, uint8_t speedCode, setThrottleResponse& response) {
+  uint16_t id = scheduleThrottle(addr, speedCode, false);
+
+  updateSpeedTable(addr, speedCode);
+
+  response.device = addr;
+  response.speed = speedCode;
+  response.transactionID = id;
+
+  return ERR_OK;
+}
+
+uint16_t DCCMain::scheduleThrottle(uint16_t addr, uint8_t speedCode, bool refresh) {
   
   uint8_t b[5];     // Packet payload. Save space for checksum byte
   uint8_t nB = 0;   // Counter for number of bytes in the packet
@@ -97,15 +139,9 @@ uint8_t DCCMain::setThrottle(uint16_t addr, uint8_t speedCode, setThrottleRespon
   b[nB++]=speedCode;
 
   incrementCounterID();
-  schedulePacket(b, nB, 0, counterID, kThrottleType, railcomAddr);
-
-  updateSpeedTable(addr, speedCode);
+  schedulePacket(b, nB, 0, counterID, kThrottleType, railcomAddr, refresh);
 
-  response.device = addr;
-  response.speed = speedCode;
-  response.transactionID = counterID;
-
-  return ERR_OK;
+  return counterID;
 }
 
 uint8_t DCCMain::setFunction(uint16_t addr, uint8_t byte1, 
@@ -322,7 +358,7 @@ uint8_t DCCMain::readCVBytesMain(uint16_t addr, uint16_t cv,
 
 }
 
-void DCCMain::updateSpeedTable(uint8_t cab, uint8_t speedCode) {
+void DCCMain::updateSpeedTable(uint16_t cab, uint8_t speedCode) {
   if(cab == 0) {
     // broadcast to all locomotives
     for(int dev = 0; dev < numDevices; dev++) 
@@ -334,7 +370,7 @@ void DCCMain::updateSpeedTable(uint8_t cab, uint8_t speedCode) {
   if(reg >= 0) speedTable[reg].speedCode = speedCode;
 }
 
-int DCCMain::lookupSpeedTable(uint8_t cab) {
+int DCCMain::lookupSpeedTable(uint16_t cab) {
   int firstEmpty = numDevices;
   int reg;
   for(reg = 0; reg < numDevices; reg++) {
@@ -355,7 +391,7 @@ int DCCMain::lookupSpeedTable(uint8_t cab) {
   return reg;
 }
 
-void DCCMain::forgetDevice(uint8_t cab) {  // removes any speed reminders for this loco  
+void DCCMain::forgetDevice(uint16_t cab) {  // removes any speed reminders for this loco  
   int reg = lookupSpeedTable(cab);
 
   if(reg >= 0) speedTable[reg].cab = 0;
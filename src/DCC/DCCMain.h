@@ -22,6 +22,7 @@
 
 #include <Arduino.h>
 
+#include "../Diagnostics/LoopProfiler.h"
 #include "Waveform.h"
 #include "Railcom.h"
 #include "Queue.h"
@@ -37,6 +38,31 @@ struct genericResponse {
   uint16_t transactionID;
 };
 
+// How a packet on the track came to be sent, for bandwidth accounting.
+enum TrafficClass : uint8_t {
+  kTrafficFirst,    // First transmission of a packet from the queue
+  kTrafficRepeat,   // Repeats of a packet from the queue
+  kTrafficRefresh,  // Speed reminders from the speed table
+  kTrafficIdle,     // Idle packets, nothing else to send
+  kTrafficClasses
+};
+
+struct TrafficCount {
+  uint16_t packets;
+  uint16_t bits;    // Including preamble, start, stop and cutout time
+};
+
+// Track traffic over one window, scaled to counts per second.
+struct BandwidthReport {
+  TrafficCount byClass[kTrafficClasses];
+  TrafficCount byType[kPacketTypes];
+  uint16_t totalBits;
+  uint16_t windowMillis;  // Actual length of the window that was measured
+};
+
+// Length of a bandwidth accounting window (millis)
+const uint16_t kBandwidthWindow = 1000;
+
 class DCCMain : public Waveform {
 public:
   DCCMain(uint8_t numDevices, Board* board, Railcom* railcom);
@@ -47,8 +73,13 @@ public:
   }
 
   void loop() {
-    Waveform::loop();
-    updateSpeed();
+    {
+      LOOP_PROFILE_SCOPE(kSectionMainTrack);
+      Waveform::loop();
+      updateSpeed();
+      updateBandwidth();
+    }
+    LOOP_PROFILE_SCOPE(kSectionRailcom);
     railcom->processData();
   }
 
@@ -93,15 +124,21 @@ public:
   // Railcom object, complements hdw object inherited from Waveform
   Railcom* railcom;
 
-  void forgetDevice(uint8_t cab);
+  void forgetDevice(uint16_t cab);
   void forgetAllDevices();
 
+  // Traffic sent in the last complete accounting window.
+  const BandwidthReport& getBandwidth() { return bandwidth; }
+
 private:
   // Queues a packet for the next device in line reminding it of its speed.
   void updateSpeed();
   // Holds state for updateSpeed function.
   uint8_t nextDev = 0;
 
+  // Builds and queues a 128-step speed packet, returns its ID.
+  uint16_t scheduleThrottle(uint16_t addr, uint8_t speedCode, bool refresh);
+
   struct Packet {
     uint8_t payload[kPacketMaxSize];
     uint8_t length;
@@ -109,16 +146,31 @@ private:
     uint16_t transmitID;  // Identifier for railcom, etc.
     PacketType type;
     uint16_t address;
+    bool refresh;   // Speed reminder rather than a new command
   };
 
   PacketType transmitType = kIdleType;
   uint16_t transmitAddress = 0;
+  TrafficClass transmitClass = kTrafficIdle;
 
   // Queue of packets, FIFO, that controls what gets sent out next. Size 5.
   Queue<Packet, 5> packetQueue;
 
   void schedulePacket(const uint8_t buffer[], uint8_t byteCount, 
-    uint8_t repeats, uint16_t identifier, PacketType type, uint16_t address);
+    uint8_t repeats, uint16_t identifier, PacketType type, uint16_t address,
+    bool refresh = false);
+
+  // Bandwidth accounting. Counted by interrupt2 into traffic, and copied out
+  // and scaled into bandwidth by updateBandwidth once per window.
+  struct Traffic {
+    TrafficCount byClass[kTrafficClasses];
+    TrafficCount byType[kPacketTypes];
+  };
+  Traffic traffic;
+  BandwidthReport bandwidth;
+  unsigned long bandwidthWindowStart = 0;
+  void countTransmit();
+  void updateBandwidth();
 
   // Railcom cutout variables
   // TODO(davidcutting42@gmail.com): Move these to the railcom class
@@ -126,8 +178,8 @@ private:
   bool inRailcomCutout = false;    // Are we in a cutout?
   bool railcomData = false;    // Is there railcom data available? 
 
-  void updateSpeedTable(uint8_t cab, uint8_t speedCode);
-  int lookupSpeedTable(uint8_t cab);
+  void updateSpeedTable(uint16_t cab, uint8_t speedCode);
+  int lookupSpeedTable(uint16_t cab);
 };
 
 #endif
\ No newline at end of file
@@ -20,74 +20,52 @@
 #include "DCCMain.h"
 
 bool DCCMain::interrupt1() {
-  switch (interruptState) {
-  case 0:   // start of bit transmission
-    board->signal(HIGH);    
-    interruptState = 1; 
-    return true; // must call interrupt2 to set currentBit
-  case 1:   // 29us after case 0
-    if(generateRailcomCutout) {
-      board->cutout(true);             // Start the cutout
-      inRailcomCutout = true;         
-      railcom->enableRecieve(true);  // Turn on the serial port so we can RX
-    }
-    interruptState = 2;
-    break;
-  case 2:   // 58us after case 0
-    if(currentBit && !generateRailcomCutout) {
-      board->signal(LOW);  
-    }
-    interruptState = 3;
-    break; 
-  case 3:   // 87us after case 0
-    if(currentBit && !generateRailcomCutout) {
-      // Return to case zero for start of another bit at 116us
-      interruptState = 0;
-    }
-    else interruptState = 4;
-    break;
-  case 4:   // 116us after case 0
-    if(!generateRailcomCutout) {
-      board->signal(LOW);
-    }
-    interruptState = 5;
-    break;
-  // Case 5 and 6 fall to default case
-  case 7:   // 203us after case 0
-    if(!generateRailcomCutout) {
-      // Return to case zero for start of another bit at 232us
-      interruptState = 0; 
-    }
-    else interruptState = 8;
-    break;
-  // Cases 8-15 are for railcom timing
-  case 16:
+  ISR_STATS_SCOPE(isrStats, kIsrInterrupt1);
+
+  uint8_t action = nextWaveAction();
+
+  if(action & kWaveCutoutEnd) {
     board->cutout(false);      // Stop the cutout
-    board->signal(LOW);     // Send out 29us of signal before case 0 flips it
+  }
+  if(action & kWaveSignalHigh) {
+    board->signal(HIGH);
+  }
+  if(action & kWaveSignalLow) {
+    board->signal(LOW);
+  }
+  if(action & kWaveCutoutStart) {
+    board->cutout(true);             // Start the cutout
+    inRailcomCutout = true;         
+    railcom->enableRecieve(true);  // Turn on the serial port so we can RX
+  }
+  else if(action & kWaveCutoutEnd) {
     railcom->enableRecieve(false); // Turn off serial so we don't get garbage
     // Read the data out and tag it with identifying info
     railcom->readData(transmitID, transmitType, transmitAddress); 
     generateRailcomCutout = false;    // Don't generate another railcom cutout
     inRailcomCutout = false;        // We aren't in a railcom pulse
-    interruptState = 0;         // Go back to start of new bit
-    break;
-  default:
-    interruptState++;
-    break;
   }
 
-  return false;   // Don't call interrupt2
+  // After the signal, so the edges keep their timing
+  CurrentSampler::tick();
+
+  // If the bit is starting, interrupt2 must be called to pick the next one
+  return action & kWaveFetchBit;
 }
 
 void DCCMain::interrupt2() {
+  ISR_STATS_SCOPE(isrStats, kIsrInterrupt2);
+
   if (remainingPreambles > 0 ) {    // If there's more preambles to be sent
-    currentBit=true;                // Send a one bit (preambles are one)
+    bitKind=kWaveOne;               // Send a one bit (preambles are one)
 
     // If we're on the first preamble bit and railcom is enabled, send out a 
     // railcom cutout. 
     if((board->getPreambles() - remainingPreambles == 0) && railcom->config.enable) {
       generateRailcomCutout = true; 
-      remainingPreambles -= 4;    // We're skipping 4 bits in the cutout
+      bitKind=kWaveCutout;
+      // We're skipping the bits covered by the cutout
+      remainingPreambles -= DefaultWaveformSchedule::kCutoutPreambles;
       return;
     }
     remainingPreambles--;   // decrement the number of preambles to send
@@ -95,7 +73,7 @@ void DCCMain::interrupt2() {
   }
   
   // beware OF 9-BIT MASK  generating a zero to start each byte   
-  currentBit=transmitPacket[bytes_sent] & kBitMask[bits_sent];
+  bitKind=(transmitPacket[bytes_sent] & kBitMask[bits_sent]) ? kWaveOne : kWaveZero;
   bits_sent++;
 
   // If this is the last bit of a byte, prepare for the next byte 
@@ -105,6 +83,8 @@ void DCCMain::interrupt2() {
     bytes_sent++;
     // if this is the last byte, prepare for next packet
     if (bytes_sent >= transmitLength) { 
+      countTransmit();
+
       // end of transmission buffer... repeat or switch to next message
       bytes_sent = 0;
       remainingPreambles = board->getPreambles() + 1;  // Add one for the stop bit
@@ -115,6 +95,7 @@ void DCCMain::interrupt2() {
       // the number of times transmitted is nRepeats+1
       if (transmitRepeats > 0) {
         transmitRepeats--;
+        transmitClass = kTrafficRepeat;
       }
       else if (pendingCount > 0) {
         // Copy pending packet to transmit packet
@@ -130,13 +111,30 @@ void DCCMain::interrupt2() {
         transmitID=pendingPacket.transmitID;
         transmitAddress=pendingPacket.address;
         transmitType=pendingPacket.type;
+        transmitClass=pendingPacket.refresh ? kTrafficRefresh : kTrafficFirst;
       }
       else {
         // Load an idle packet
         memcpy(transmitPacket, kIdlePacket, sizeof(kIdlePacket));
         transmitLength=sizeof(kIdlePacket);
         transmitRepeats=0;
+        transmitClass=kTrafficIdle;
       }
     }
   }
 }
+
+void DCCMain::countTransmit() {
+  if(transmitLength == 0) return;   // Nothing loaded yet after startup
+
+  // Preambles (including any cutout) plus the end bit, then a start bit and 
+  // eight data bits per byte.
+  uint16_t bits = board->getPreambles() + 1 + transmitLength * 9;
+  // Idle packets don't update transmitType, it still holds the last packet's
+  PacketType type = (transmitClass == kTrafficIdle) ? kIdleType : transmitType;
+
+  traffic.byClass[transmitClass].packets++;
+  traffic.byClass[transmitClass].bits += bits;
+  traffic.byType[type].packets++;
+  traffic.byType[type].bits += bits;
+}
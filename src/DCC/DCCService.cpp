@@ -84,6 +84,18 @@ const ackOpCodes PROGMEM WRITE_BYTE_PROG[] = {
   ITC1,       // if ok callback (1)
   FAIL        // callback (-1)
 };
+
+// Saves the write (and a decoder EEPROM cycle) if the CV already holds the 
+// value. Reports 0 if the write was skipped.
+const ackOpCodes PROGMEM WRITE_BYTE_IF_DIFFERENT_PROG[] = {
+  BASELINE,
+  VB,WACK,    // already set?
+  ITC0,       // if so callback (0)
+  WB,WACK,
+  VB,WACK,
+  ITC1,
+  FAIL
+};
       
       
 const ackOpCodes PROGMEM READ_CV_PROG[] = {
@@ -104,84 +116,599 @@ const ackOpCodes PROGMEM READ_CV_PROG[] = {
   FAIL              // verification failed
 };          
 
+// Starts with the predicted value in ackManagerByte. One byte verify is enough
+// if the prediction is right, otherwise this falls back to READ_CV_PROG.
+const ackOpCodes PROGMEM READ_CV_PREDICTED_PROG[] = {
+  BASELINE,
+  VB, WACK, ITCB,   // prediction right, return it
+  STARTMERGE,
+  V0, WACK, MERGE,
+  V0, WACK, MERGE,
+  V0, WACK, MERGE,
+  V0, WACK, MERGE,
+  V0, WACK, MERGE,
+  V0, WACK, MERGE,
+  V0, WACK, MERGE,
+  V0, WACK, MERGE,
+  VB, WACK, ITCB,
+  FAIL
+};
+
+// Answers a read from the cache
+const ackOpCodes PROGMEM CACHED_CV_PROG[] = {
+  CB
+};
+
+// Parks a restore until the next CV of the image arrives
+const ackOpCodes PROGMEM RESTORE_WAIT_PROG[] = {
+  WAITCV
+};
+
+// Values most decoders ship with, used as the prediction when reading these
+// CVs without one.
+struct CommonCVDefault {
+  uint16_t cv;
+  uint8_t value;
+};
+
+const CommonCVDefault PROGMEM kCommonCVDefaults[] = {
+  {1, 3},     // Short address
+  {19, 0},    // Consist address
+  {29, 6},    // 28/128 speed steps, analog operation allowed
+};
+
+// CV29 bit selecting the long address in CV17/18
+const uint8_t kCV29LongAddress = 0x20;
+
 uint8_t DCCService::writeCVByte(uint16_t cv, uint8_t bValue, uint16_t callback, 
-  uint16_t callbackSub, Print* stream, ACK_CALLBACK callbackFunc) {
+  uint16_t callbackSub, Print* stream, ACK_CALLBACK callbackFunc, 
+  serviceJobResponse& response, uint8_t priority, bool ifDifferent) {
   
-  ackManagerSetup(cv, bValue, WRITE_BYTE_PROG, WRITECV, callback, callbackSub, stream, callbackFunc);
+  return scheduleJob(cv, bValue, writeProgram(cv, bValue, ifDifferent), 
+    WRITECV, callback, callbackSub, stream, callbackFunc, priority, response);
+}
+
+ackOpCodes const * DCCService::writeProgram(uint16_t cv, uint8_t value, 
+  bool ifDifferent) {
+  // No point verifying first if the cache knows the value is different
+  uint8_t cached;
+  if(!ifDifferent || (CVCache::lookup(cacheDecoder, cv, cached) && 
+    cached != value)) return WRITE_BYTE_PROG;
+  return WRITE_BYTE_IF_DIFFERENT_PROG;
+}
+
+bool DCCService::addSessionOp(SessionOpKind kind, uint16_t cv, 
+  uint8_t value) {
+  if(sessionJobID != 0 || sessionLength >= kSessionSize) return false;
+  session[sessionLength].cv = cv;
+  session[sessionLength].value = value;
+  session[sessionLength].kind = kind;
+  sessionLength++;
+  return true;
+}
+
+void DCCService::clearSession() {
+  if(sessionJobID != 0) return;
+  sessionLength = 0;
+}
+
+bool DCCService::getSessionStatus(sessionStatusResponse& response) {
+  response.length = sessionLength;
+  response.written = sessionWritten;
+  response.skipped = sessionSkipped;
+  response.failed = sessionFailed;
+  response.done = sessionNext;
+  return sessionJobID != 0;
+}
 
+uint8_t DCCService::runSession(uint16_t callback, uint16_t callbackSub, 
+  Print* stream, ACK_CALLBACK callbackFunc, serviceJobResponse& response, 
+  uint8_t priority) {
+  
+  // Only one session can be in flight, and an empty one has nothing to do
+  if(sessionJobID != 0 || sessionLength == 0) return ERR_BUSY;
+
+  // The first operation is loaded when the job starts, which may be right 
+  // away, so the job has to be known as the session before it's scheduled
+  sessionJobID = nextJobID;
+  sessionNext = 0;
+  uint8_t result = scheduleJob(session[0].cv, session[0].value, NULL, 
+    READCV, callback, callbackSub, stream, callbackFunc, priority, response);
+  if(result != ERR_OK) {
+    sessionJobID = 0;
+    return result;
+  }
+
+  sessionWritten = sessionSkipped = sessionFailed = 0;
   return ERR_OK;
 }
 
+void DCCService::loadSessionOp(uint8_t index, bool baseline) {
+  const SessionOp& op = session[index];
+  ackManagerCV = op.cv;
+  if(op.kind == kSessionRead) {
+    ackManagerType = READCV;
+    ackManagerProg = readProgram(op.cv, kCacheVerify, ackManagerByte);
+  }
+  else {
+    ackManagerType = WRITECV;
+    ackManagerByte = op.value;
+    ackManagerProg = writeProgram(op.cv, op.value, 
+      op.kind == kSessionWriteIfDifferent);
+  }
+  // Only the first operation of the session takes a baseline
+  if(!baseline && pgm_read_byte_near(ackManagerProg) == BASELINE) 
+    ackManagerProg++;
+  ackManagerProgStart = ackManagerProg;
+}
+
+uint8_t DCCService::identifyDecoder(uint16_t callback, uint16_t callbackSub, 
+  Print* stream, IDENTIFY_CALLBACK callbackFunc, serviceJobResponse& response,
+  uint8_t priority) {
 
-uint8_t DCCService::writeCVBit(uint16_t cv, uint8_t bNum, uint8_t bValue, 
-  uint16_t callback, uint16_t callbackSub, Print* stream, ACK_CALLBACK callbackFunc) {
+  if(identifyJobID != 0) return ERR_BUSY;
+
+  identity.callback = callback;
+  identity.callbackSub = callbackSub;
+  identifyCallback = callbackFunc;
+  identifyStream = stream;
+  identifyStep = 0;
 
-  ackManagerSetup(cv, bNum, (bValue==0 ? WRITE_BIT0_PROG : WRITE_BIT1_PROG), 
-    WRITECVBIT, callback, callbackSub, stream, callbackFunc);
+  // As with sessions, the job has to be known before it can start
+  identifyJobID = nextJobID;
+  uint8_t result = scheduleJob(identifyCV(0), 0, NULL, READCV, callback, 
+    callbackSub, stream, NULL, priority, response);
+  if(result != ERR_OK) identifyJobID = 0;
+  return result;
+}
+
+uint16_t DCCService::identifyCV(uint8_t step) {
+  // Manufacturer first, so a different decoder stops the cached values of 
+  // the selected one being used as predictions
+  bool longAddress = step > 2 && (identifyValues[2] & kCV29LongAddress);
+  switch(step) {
+  case 0: return 8;
+  case 1: return 7;
+  case 2: return 29;
+  case 3: return longAddress ? 17 : 1;
+  case 4: return longAddress ? 18 : 0;
+  }
+  return 0;
+}
+
+void DCCService::loadIdentifyStep(bool baseline) {
+  ackManagerCV = identifyCV(identifyStep);
+  ackManagerType = READCV;
+  ackManagerProg = readProgram(ackManagerCV, kCacheVerify, ackManagerByte);
+  if(!baseline && pgm_read_byte_near(ackManagerProg) == BASELINE) 
+    ackManagerProg++;
+  ackManagerProgStart = ackManagerProg;
+}
+
+void DCCService::identifyResult(int value) {
+  if(value >= 0) {
+    identifyValues[identifyStep++] = value;
+    if(identifyCV(identifyStep) != 0) {
+      loadIdentifyStep(false);
+      return;
+    }
+  }
+  finishIdentify();
+}
+
+void DCCService::finishIdentify() {
+  identifyJobID = 0;
+  identity.manufacturer = identifyStep > 0 ? identifyValues[0] : -1;
+  identity.version = identifyStep > 1 ? identifyValues[1] : -1;
+  identity.config = identifyStep > 2 ? identifyValues[2] : -1;
+  identity.address = -1;
+  if(identifyStep > 3 && identifyCV(identifyStep) == 0) {
+    identity.address = identifyStep == kIdentifySteps 
+      ? ((identifyValues[3] & 0x3F) << 8) | identifyValues[4] 
+      : identifyValues[3];
+
+    // Nothing was cached while reading, the identity wasn't known
+    selectCacheDecoder(identity.manufacturer, identity.version, 
+      identity.address);
+    for(uint8_t step = 0; step < identifyStep; step++) 
+      CVCache::store(cacheDecoder, identifyCV(step), identifyValues[step]);
+  }
+  identifyCallback(identifyStream, identity);
+}
+
+uint8_t DCCService::backupCVs(uint16_t firstCV, uint16_t lastCV, 
+  uint16_t callback, uint16_t callbackSub, Print* stream, 
+  BACKUP_CALLBACK callbackFunc, serviceJobResponse& response, 
+  uint8_t priority) {
+
+  // Only one backup can be in flight, and an empty range has nothing to do
+  if(backupJobID != 0 || firstCV == 0 || firstCV > lastCV) return ERR_BUSY;
+
+  backupFrame.callback = callback;
+  backupFrame.callbackSub = callbackSub;
+  backupFrame.firstCV = firstCV;
+  backupFrame.count = 0;
+  backupCallback = callbackFunc;
+  backupStream = stream;
+  backupNext = firstCV;
+  backupLast = lastCV;
+
+  backupJobID = nextJobID;
+  uint8_t result = scheduleJob(firstCV, 0, NULL, READCV, callback, 
+    callbackSub, stream, NULL, priority, response);
+  if(result != ERR_OK) backupJobID = 0;
+  return result;
+}
+
+void DCCService::loadBackupCV(bool baseline) {
+  ackManagerCV = backupNext;
+  ackManagerType = READCV;
+  ackManagerProg = readProgram(backupNext, kCacheVerify, ackManagerByte);
+  if(!baseline && pgm_read_byte_near(ackManagerProg) == BASELINE) 
+    ackManagerProg++;
+  ackManagerProgStart = ackManagerProg;
+}
+
+void DCCService::backupResult(int value) {
+  backupFrame.values[backupFrame.count++] = value;
+  if(backupFrame.count == kBackupFrameSize) sendBackupFrame();
+  if(backupNext++ < backupLast) {
+    loadBackupCV(false);
+    return;
+  }
+  finishBackup();
+}
+
+void DCCService::sendBackupFrame() {
+  if(backupFrame.count == 0) return;
+  backupCallback(backupStream, backupFrame);
+  backupFrame.firstCV += backupFrame.count;
+  backupFrame.count = 0;
+}
+
+void DCCService::finishBackup() {
+  backupJobID = 0;
+  sendBackupFrame();
+  // The end marker, with backupNext as the CV to resume from
+  backupFrame.firstCV = backupNext;
+  backupCallback(backupStream, backupFrame);
+}
 
+uint8_t DCCService::restoreCVs(uint16_t callback, uint16_t callbackSub, 
+  Print* stream, ACK_CALLBACK callbackFunc, serviceJobResponse& response, 
+  uint8_t priority) {
+
+  if(restoreJobID != 0) return ERR_BUSY;
+
+  restoreHead = restoreCount = 0;
+  restoreEnded = restoreWaiting = restoreTimedOut = false;
+  restoreBaseline = true;
+  restoreJobID = nextJobID;
+  uint8_t result = scheduleJob(0, 0, RESTORE_WAIT_PROG, WRITECV, callback, 
+    callbackSub, stream, callbackFunc, priority, response);
+  if(result != ERR_OK) {
+    restoreJobID = 0;
+    return result;
+  }
+
+  restoreDone = restoreWritten = restoreSkipped = restoreFailed = 0;
   return ERR_OK;
 }
 
+bool DCCService::addRestoreCV(uint16_t cv, uint8_t value) {
+  if(restoreJobID == 0 || restoreEnded || restoreCount >= kRestoreBufferSize) 
+    return false;
+  RestoreCV& entry = 
+    restoreBuffer[(restoreHead + restoreCount) % kRestoreBufferSize];
+  entry.cv = cv;
+  entry.value = value;
+  restoreCount++;
+  return true;
+}
+
+bool DCCService::getRestoreStatus(restoreStatusResponse& response) {
+  response.buffered = restoreCount;
+  response.done = restoreDone;
+  response.written = restoreWritten;
+  response.skipped = restoreSkipped;
+  response.failed = restoreFailed;
+  response.timedOut = restoreTimedOut;
+  return restoreJobID != 0;
+}
+
+void DCCService::loadRestoreCV() {
+  const RestoreCV& entry = restoreBuffer[restoreHead];
+  restoreHead = (restoreHead + 1) % kRestoreBufferSize;
+  restoreCount--;
+
+  ackManagerCV = entry.cv;
+  ackManagerByte = entry.value;
+  ackManagerType = WRITECV;
+  ackManagerProg = writeProgram(entry.cv, entry.value, true);
+  // Only the first CV written takes a baseline
+  if(!restoreBaseline && pgm_read_byte_near(ackManagerProg) == BASELINE) 
+    ackManagerProg++;
+  restoreBaseline = false;
+  ackManagerProgStart = ackManagerProg;
+}
+
+uint8_t DCCService::writeCVBit(uint16_t cv, uint8_t bNum, uint8_t bValue, 
+  uint16_t callback, uint16_t callbackSub, Print* stream, ACK_CALLBACK callbackFunc,
+  serviceJobResponse& response, uint8_t priority) {
+
+  return scheduleJob(cv, bNum, (bValue==0 ? WRITE_BIT0_PROG : WRITE_BIT1_PROG), 
+    WRITECVBIT, callback, callbackSub, stream, callbackFunc, priority, response);
+}
+
 
 uint8_t DCCService::readCV(uint16_t cv, uint16_t callback, uint16_t callbackSub, 
-  Print* stream, ACK_CALLBACK callbackFunc) {
+  Print* stream, ACK_CALLBACK callbackFunc, serviceJobResponse& response, 
+  uint8_t priority, CVCacheMode cacheMode) {
   
-  ackManagerSetup(cv, 0, READ_CV_PROG, READCV, callback, callbackSub, stream, callbackFunc);
+  uint8_t predicted;
+  ackOpCodes const * program = readProgram(cv, cacheMode, predicted);
+  return scheduleJob(cv, predicted, program, READCV, callback, callbackSub, 
+    stream, callbackFunc, priority, response);
+}
 
-  return ERR_OK;
+ackOpCodes const * DCCService::readProgram(uint16_t cv, 
+  CVCacheMode cacheMode, uint8_t& predicted) {
+  if(cacheMode != kCacheBypass && CVCache::lookup(cacheDecoder, cv, predicted))
+    return cacheMode == kCacheTrust ? CACHED_CV_PROG : READ_CV_PREDICTED_PROG;
+
+  for(uint8_t i = 0; i < sizeof(kCommonCVDefaults)/sizeof(kCommonCVDefaults[0]); i++) {
+    if(pgm_read_word_near(&kCommonCVDefaults[i].cv) != cv) continue;
+    predicted = pgm_read_byte_near(&kCommonCVDefaults[i].value);
+    return READ_CV_PREDICTED_PROG;
+  }
+
+  predicted = 0;
+  return READ_CV_PROG;
+}
+
+uint8_t DCCService::readCVPredicted(uint16_t cv, uint8_t predicted, 
+  uint16_t callback, uint16_t callbackSub, Print* stream, 
+  ACK_CALLBACK callbackFunc, serviceJobResponse& response, uint8_t priority) {
+
+  return scheduleJob(cv, predicted, READ_CV_PREDICTED_PROG, READCV, callback, 
+    callbackSub, stream, callbackFunc, priority, response);
 }
 
-void DCCService::ackManagerSetup(uint16_t cv, uint8_t value, 
+uint8_t DCCService::scheduleJob(uint16_t cv, uint8_t value, 
   ackOpCodes const program[], cv_edit_type type, uint16_t callbackNum, 
-  uint16_t callbackSub, Print* stream, ACK_CALLBACK callback) {
-  
-  ackManagerCV = cv;
-  ackManagerProg = program;
-  ackManagerByte = value;
-  ackManagerBitNum = value;
-  ackManagerCallback = callback;
-  ackManagerCallbackNum = callbackNum;
-  ackManagerCallbackSub = callbackSub;
-  ackManagerType = type;
-  responseStream = stream;
+  uint16_t callbackSub, Print* stream, ACK_CALLBACK callback, uint8_t priority,
+  serviceJobResponse& response) {
+
+  if(jobQueueCount >= kServiceJobQueueSize) return ERR_BUSY;
+
+  // Goes behind everything of the same or higher priority
+  uint8_t slot = 0;
+  while(slot < jobQueueCount && jobQueue[slot].priority >= priority) slot++;
+  for(uint8_t i = jobQueueCount; i > slot; i--) jobQueue[i] = jobQueue[i-1];
+
+  ServiceJob& job = jobQueue[slot];
+  job.program = program;
+  job.cv = cv;
+  job.value = value;
+  job.type = type;
+  job.priority = priority;
+  job.jobID = nextJobID++;
+  if(nextJobID == 0) nextJobID = 1;
+  job.callbackNum = callbackNum;
+  job.callbackSub = callbackSub;
+  job.stream = stream;
+  job.callback = callback;
+  job.cacheDecoder = cacheDecoder;
+  jobQueueCount++;
+
+  response.jobID = job.jobID;
+  response.position = slot + (ackManagerProg ? 1 : 0);
+
+  if(!ackManagerProg) startNextJob();
+
+  return ERR_OK;
+}
+
+void DCCService::startNextJob() {
+  if(jobQueueCount == 0) return;
+
+  ServiceJob& job = jobQueue[0];
+  ackManagerCV = job.cv;
+  ackManagerProg = job.program;
+  ackManagerByte = job.value;
+  ackManagerBitNum = job.value;
+  ackManagerCallback = job.callback;
+  ackManagerCallbackNum = job.callbackNum;
+  ackManagerCallbackSub = job.callbackSub;
+  ackManagerType = job.type;
+  ackManagerJobID = job.jobID;
+  ackManagerCacheDecoder = job.cacheDecoder;
+  ackManagerResets = kResetRepeats;
+  ackLostRetries = 0;
+  responseStream = job.stream;
+  if(job.jobID == sessionJobID) loadSessionOp(0, true);
+  else if(job.jobID == identifyJobID) loadIdentifyStep(true);
+  else if(job.jobID == backupJobID) loadBackupCV(true);
+  ackManagerProgStart = ackManagerProg;
+  applyTiming();
+
+  jobQueueCount--;
+  for(uint8_t i = 0; i < jobQueueCount; i++) jobQueue[i] = jobQueue[i+1];
+}
+
+bool DCCService::cancelJob(uint16_t jobID) {
+  if(ackManagerProg && ackManagerJobID == jobID) {
+    ackPending = false;
+    ackManagerAdapted = false;    // No retry
+    if(jobID == sessionJobID) sessionJobID = 0;
+    if(jobID == restoreJobID) {
+      restoreJobID = 0;
+      // Nothing to report while waiting for the image
+      if(ackManagerProg == RESTORE_WAIT_PROG) {
+        ackManagerProg = NULL;
+        return true;
+      }
+    }
+    if(jobID == backupJobID) {
+      // The CV being read is where to resume
+      ackManagerProg = NULL;
+      finishBackup();
+      return true;
+    }
+    finishJob(-1);
+    return true;
+  }
+
+  for(uint8_t slot = 0; slot < jobQueueCount; slot++) {
+    if(jobQueue[slot].jobID != jobID) continue;
+
+    ServiceJob job = jobQueue[slot];
+    if(jobID == sessionJobID) sessionJobID = 0;
+    jobQueueCount--;
+    for(uint8_t i = slot; i < jobQueueCount; i++) jobQueue[i] = jobQueue[i+1];
+
+    if(jobID == identifyJobID) {
+      finishIdentify();
+      return true;
+    }
+    if(jobID == backupJobID) {
+      finishBackup();
+      return true;
+    }
+    if(jobID == restoreJobID) restoreJobID = 0;
+
+    serviceModeResponse response;
+    response.cv = job.cv;
+    response.cvBitNum = job.type == WRITECVBIT ? job.value : 0;
+    response.cvValue = -1;
+    response.callback = job.callbackNum;
+    response.callbackSub = job.callbackSub;
+    response.type = job.type;
+    job.callback(job.stream, response);
+    return true;
+  }
+
+  return false;
+}
+
+void DCCService::selectCacheDecoder(uint8_t manufacturer, uint8_t version, 
+  uint16_t address) {
+  cacheDecoder = CVCache::select(manufacturer, version, address);
+}
+
+bool DCCService::getJob(uint8_t position, uint16_t& jobID, uint16_t& cv) {
+  if(ackManagerProg) {
+    if(position == 0) {
+      jobID = ackManagerJobID;
+      cv = ackManagerCV;
+      return true;
+    }
+    position--;
+  }
+  if(position >= jobQueueCount) return false;
+  jobID = jobQueue[position].jobID;
+  cv = jobQueue[position].cv;
+  return true;
 }
 
 void DCCService::setAckPending() {
-  //ackPulseStart = 0;
-  //ackPulseDuration = 0;
+  ackSampling = false;
+  ackSampleTail = ackSampleHead;
+  ackSamplesDropped = false;
+  ackLost = false;
+  ackPulseSamples = 0;
+  ackLowSamples = 0;
+  ackPulseTooLong = false;
   ackDetected = false;
-  //ackCheckStart = millis();
   ackPending = true;
+  ackSampling = true;
 }
 
 uint8_t DCCService::didAck() {
   if(ackPending) return (2);
+  if(ackLost) return (3);
   if(ackDetected) return (1);
   return(0);
 }
 
 void DCCService::checkAck() {
-  if(transmitResetCount > 6) {
-    // ackCheckDuration = millis() - ackCheckStart;
+  while(ackSampleTail != ackSampleHead) {
+    uint16_t sample = ackSamples[ackSampleTail];
+    ackSampleTail = (ackSampleTail + 1) & (kAckSampleBufferSize - 1);
+
+    lastCurrent = board->getCurrentMilliamps(sample);
+    if(ackSample(lastCurrent)) {
+      ackDetected = true;
+      ackPending = false;
+      ackSampling = false;
+      recordTiming();
+      return;
+    }
+  }
+
+  // The samples that were kept come before the gap, so an ACK found in them
+  // stands. Otherwise there's no telling what was missed.
+  if(ackSamplesDropped) {
+    ackLost = true;
     ackPending = false;
+    ackSampling = false;
     return;
   }
 
-  lastCurrent = board->getCurrentMilliamps();
-
-  // Detect the leading edge of a pulse
-  if(lastCurrent-board->getCurrentBase() > kACKThreshold) {
-    ackDetected = true;
+  // Give up, unless a pulse is still being measured
+  if(transmitResetCount > ackManagerTimeout && ackPulseSamples == 0) {
     ackPending = false;
-    transmitRepeats = 0;  // stop sending repeats
+    ackSampling = false;
+  }
+}
 
-    return; 
+bool DCCService::ackSample(uint16_t current) {
+  int16_t rise = current - board->getCurrentBase();
+
+  // Leading edge. Note how far the instruction had got, resets are only 
+  // counted once all its repeats are out.
+  if(ackPulseSamples == 0) {
+    if(rise > kACKThreshold) {
+      ackPulseSamples = 1;
+      ackEdgeResets = transmitResetCount;
+      ackEdgePackets = ackEdgeResets > 0 ? ackManagerRepeats + 1 
+        : ackManagerRepeats - transmitRepeats;
+    }
+    return false;
   }
+
+  // Still high. Uses half the threshold so the pulse isn't ended by a 
+  // sample near it.
+  if(rise > kACKThreshold / 2) {
+    ackPulseSamples += 1 + ackLowSamples;
+    ackLowSamples = 0;
+    uint32_t width = (uint32_t)ackPulseSamples * kAckSampleMicros;
+    // Long enough to be an ACK, no need to send the rest of the repeats
+    if(width >= MIN_ACK_PULSE_DURATION) ackCutRepeats = true;
+    if(width > MAX_ACK_PULSE_DURATION) {
+      ackPulseTooLong = true;
+      ackPulseSamples = MAX_ACK_PULSE_DURATION / kAckSampleMicros + 1;
+    }
+    return false;
+  }
+
+  if(++ackLowSamples < kAckNoiseSamples) return false;
+
+  // Trailing edge. Too short is noise, too long is something else drawing 
+  // current (a motor starting, a short).
+  uint32_t width = (uint32_t)ackPulseSamples * kAckSampleMicros;
+  bool valid = !ackPulseTooLong && width >= MIN_ACK_PULSE_DURATION;
+  ackPulseSamples = 0;
+  ackLowSamples = 0;
+  ackPulseTooLong = false;
+  return valid;
 }
 
 void DCCService::ackManagerLoop() {
   if(ackPending) checkAck();
 
+  if(!ackManagerProg) startNextJob();
+
   while (ackManagerProg) {
 
     // breaks from this switch will step to next prog entry
@@ -198,44 +725,48 @@ void DCCService::ackManagerLoop() {
     case W0:    // write 0 bit 
     case W1:    // write 1 bit 
       {
-        if (resets<kResetRepeats) return; // try later 
+        if (resets<ackManagerResets) return; // try later 
         uint8_t instruction = WRITE_BIT | (opcode==W1 ? BIT_ON : BIT_OFF) | ackManagerBitNum;
         uint8_t message[] = {cv1(BIT_MANIPULATE, ackManagerCV), cv2(ackManagerCV), instruction };
         incrementCounterID();
-        schedulePacket(message, sizeof(message), kProgRepeats, counterID);
+        schedulePacket(message, sizeof(message), ackManagerRepeats, counterID);
         setAckPending(); 
+        ackManagerResets = kResetRepeats;   // decoder recovery after a write
       }
       break; 
     
     case WB:   // write byte 
       {
-        if (resets<kResetRepeats) return; // try later 
+        if (resets<ackManagerResets) return; // try later 
         uint8_t message[] = {cv1(WRITE_BYTE, ackManagerCV), cv2(ackManagerCV), ackManagerByte };
         incrementCounterID();
-        schedulePacket(message, sizeof(message), kProgRepeats, counterID);
+        schedulePacket(message, sizeof(message), ackManagerRepeats, counterID);
         setAckPending(); 
+        ackManagerResets = kResetRepeats;
       }
       break;
     
     case VB:     // Issue validate Byte packet
       {
-        if (resets<kResetRepeats) return; // try later 
+        if (resets<ackManagerResets) return; // try later 
         uint8_t message[] = { cv1(VERIFY_BYTE, ackManagerCV), cv2(ackManagerCV), ackManagerByte };
         incrementCounterID();
-        schedulePacket(message, sizeof(message), kProgRepeats, counterID);
+        schedulePacket(message, sizeof(message), ackManagerRepeats, counterID);
         setAckPending(); 
+        ackManagerResets = verifyResets();
       }
       break;
     
     case V0:
     case V1:      // Issue validate bit=0 or bit=1  packet
       {
-        if (resets<kResetRepeats) return; // try later 
+        if (resets<ackManagerResets) return; // try later 
         uint8_t instruction = VERIFY_BIT | (opcode==V0?BIT_OFF:BIT_ON) | ackManagerBitNum;
         uint8_t message[] = {cv1(BIT_MANIPULATE, ackManagerCV), cv2(ackManagerCV), instruction };
         incrementCounterID();
-        schedulePacket(message, sizeof(message), kProgRepeats, counterID);
+        schedulePacket(message, sizeof(message), ackManagerRepeats, counterID);
         setAckPending(); 
+        ackManagerResets = verifyResets();
       }
       break;
     
@@ -243,6 +774,18 @@ void DCCService::ackManagerLoop() {
       {
         uint8_t ackState = didAck();
         if (ackState==2) return; // keep polling
+        if (ackState==3) {
+          // Samples were lost, send the instruction again rather than take 
+          // the gap for a NACK
+          if (++ackLostRetries > kAckLostRetries) {
+            ackLostRetries = 0;
+            finishJob(-1);
+            return;
+          }
+          ackManagerProg--;
+          continue;
+        }
+        ackLostRetries = 0;
         ackReceived = (ackState==1);
       }
       break;  // we have an ACK result (good or bad)
@@ -250,15 +793,7 @@ void DCCService::ackManagerLoop() {
     case ITC1:   // If True Callback(0 or 1)  (if prevous WACK got an ACK)
       {
         if (ackReceived) {
-          ackManagerProg = NULL; // all done now
-          serviceModeResponse response;
-          response.cv = ackManagerCV;
-          response.cvBitNum = ackManagerBitNum;
-          response.cvValue = opcode==ITC0?0:1;
-          response.callback = ackManagerCallbackNum;
-          response.callbackSub = ackManagerCallbackSub; 
-          response.type = ackManagerType;
-          callback(responseStream, response);
+          finishJob(opcode==ITC0?0:1);
           return;
         }
       }
@@ -267,15 +802,7 @@ void DCCService::ackManagerLoop() {
     case ITCB:   // If True callback(byte)
       {
         if (ackReceived) {
-          ackManagerProg = NULL; // all done now
-          serviceModeResponse response;
-          response.cv = ackManagerCV;
-          response.cvBitNum = 0;
-          response.cvValue = ackManagerByte;
-          response.callback = ackManagerCallbackNum;
-          response.callbackSub = ackManagerCallbackSub; 
-          response.type = ackManagerType;
-          callback(responseStream, response);
+          finishJob(ackManagerByte);
           return;
         }
       }
@@ -284,30 +811,14 @@ void DCCService::ackManagerLoop() {
     case NACKFAIL:   // If nack callback(-1)
       {
         if (!ackReceived) {
-          ackManagerProg = NULL; // all done now
-          serviceModeResponse response;
-          response.cv = ackManagerCV;
-          response.cvValue = -1;
-          response.callback = ackManagerCallbackNum;
-          response.callbackSub = ackManagerCallbackSub; 
-          response.type = ackManagerType;
-          callback(responseStream, response);
+          finishJob(-1);
           return;
         }
       }
       break;
       
     case FAIL:  // callback(-1)
-      {
-        ackManagerProg = NULL;
-        serviceModeResponse response;
-        response.cv = ackManagerCV;
-        response.cvValue = -1;
-        response.callback = ackManagerCallbackNum;
-        response.callbackSub = ackManagerCallbackSub; 
-        response.type = ackManagerType;
-        callback(responseStream, response);
-      }
+      finishJob(-1);
       return;
           
     case STARTMERGE:
@@ -315,6 +826,28 @@ void DCCService::ackManagerLoop() {
       ackManagerByte=0;     
       break;
         
+    case CB:  // callback(byte)
+      finishJob(ackManagerByte);
+      return;
+
+    case WAITCV:
+      if(restoreCount > 0) {
+        restoreWaiting = false;
+        loadRestoreCV();
+        continue;
+      }
+      if(!restoreWaiting) {
+        restoreWaiting = true;
+        restoreWaitStart = millis();
+      }
+      if(!restoreEnded && millis() - restoreWaitStart >= kRestoreIdleMillis)
+        restoreTimedOut = true;
+      if(restoreEnded || restoreTimedOut) {
+        restoreJobID = 0;
+        ackManagerProg = NULL;
+      }
+      return;
+
     case MERGE:  // Merge previous Validate zero wack response with byte value and update bit number (use for reading CV bytes)
       ackManagerByte <<= 1;
       // ackReceived means bit is zero. 
@@ -322,21 +855,141 @@ void DCCService::ackManagerLoop() {
       ackManagerBitNum--;
       break;
     default: 
-      {
-        ackManagerProg=NULL;
-        serviceModeResponse response;
-        response.cv = ackManagerCV;
-        response.cvValue = -1;
-        response.callback = ackManagerCallbackNum;
-        response.callbackSub = ackManagerCallbackSub; 
-        response.type = ackManagerType;
-        callback(responseStream, response);
-      }
+      finishJob(-1);
       return;        
     }  // end of switch
     ackManagerProg++;
   }
 }
-void DCCService::callback(Print* stream, serviceModeResponse response) {
-  (ackManagerCallback)(stream, response);
+void DCCService::applyTiming() {
+  ackManagerRepeats = kProgRepeats;
+  ackManagerTimeout = kAckTimeoutResets;
+  ackManagerVerifyResets = kResetRepeats;
+  ackManagerAdapted = false;
+
+  CVCacheDecoder decoder;
+  if(!CVCache::getDecoder(ackManagerCacheDecoder, decoder) || 
+    decoder.ackCount < kTimingObservations) return;
+
+  uint8_t repeats = decoder.ackPackets + kAckMarginPackets - 1;
+  if(repeats < kMinProgRepeats) repeats = kMinProgRepeats;
+  uint8_t timeout = decoder.ackResets + kAckMarginResets;
+  if(repeats < ackManagerRepeats) {
+    ackManagerRepeats = repeats;
+    ackManagerAdapted = true;
+  }
+  if(timeout < ackManagerTimeout) {
+    ackManagerTimeout = timeout;
+    ackManagerAdapted = true;
+  }
+  // A verify never gets fewer resets than the S-9.2.3 minimum
+  uint8_t verify = timeout < kSessionResetRepeats ? kSessionResetRepeats 
+    : timeout;
+  if(verify < ackManagerVerifyResets) {
+    ackManagerVerifyResets = verify;
+    ackManagerAdapted = true;
+  }
+}
+
+void DCCService::recordTiming() {
+  CVCacheDecoder decoder;
+  if(!CVCache::getDecoder(ackManagerCacheDecoder, decoder)) return;
+
+  // Only written while learning or when the decoder turns out to be slower
+  bool changed = false;
+  if(ackEdgePackets > decoder.ackPackets) {
+    decoder.ackPackets = ackEdgePackets;
+    changed = true;
+  }
+  if(ackEdgeResets > decoder.ackResets) {
+    decoder.ackResets = ackEdgeResets;
+    changed = true;
+  }
+  if(decoder.ackCount < kTimingObservations) {
+    decoder.ackCount++;
+    changed = true;
+  }
+  if(changed) CVCache::setDecoder(ackManagerCacheDecoder, decoder);
+}
+
+void DCCService::forgetTiming() {
+  CVCacheDecoder decoder;
+  if(!CVCache::getDecoder(ackManagerCacheDecoder, decoder)) return;
+  decoder.ackPackets = 0;
+  decoder.ackResets = 0;
+  decoder.ackCount = 0;
+  CVCache::setDecoder(ackManagerCacheDecoder, decoder);
+}
+
+void DCCService::finishJob(int value) {
+  // The learned timing may be too tight (a slower decoder with the same 
+  // identity, a dirty track). Go back to the defaults and try once more.
+  if(value < 0 && ackManagerAdapted) {
+    forgetTiming();
+    applyTiming();
+    ackManagerProg = ackManagerProgStart;
+    ackManagerResets = kResetRepeats;
+    return;
+  }
+
+  ackManagerProg = NULL; // all done now
+
+  // A different decoder is on the track, stop caching against the old one
+  CVCacheDecoder identity;
+  if(ackManagerType == READCV && value >= 0 && 
+    CVCache::getDecoder(ackManagerCacheDecoder, identity) &&
+    ((ackManagerCV == 8 && value != identity.manufacturer) ||
+    (ackManagerCV == 7 && value != identity.version))) {
+    if(cacheDecoder == ackManagerCacheDecoder) clearCacheDecoder();
+    ackManagerCacheDecoder = kCVCacheNoDecoder;
+  }
+
+  if(ackManagerJobID == identifyJobID) {
+    identifyResult(value);
+    return;
+  }
+
+  // A failed write leaves the CV unknown, a bit write leaves it partly known
+  if(ackManagerType == READCV && value >= 0)
+    CVCache::store(ackManagerCacheDecoder, ackManagerCV, value);
+  else if(ackManagerType == WRITECV && value >= 0)
+    CVCache::store(ackManagerCacheDecoder, ackManagerCV, ackManagerByte);
+  else if(ackManagerType != READCV)
+    CVCache::invalidate(ackManagerCacheDecoder, ackManagerCV);
+
+  if(ackManagerJobID == backupJobID) {
+    backupResult(value);
+    return;
+  }
+  
+  serviceModeResponse response;
+  response.cv = ackManagerCV;
+  response.cvBitNum = ackManagerType == WRITECVBIT ? ackManagerBitNum : 0;
+  response.cvValue = value;
+  response.callback = ackManagerCallbackNum;
+  response.callbackSub = ackManagerCallbackSub; 
+  response.type = ackManagerType;
+  (ackManagerCallback)(responseStream, response);
+
+  if(ackManagerJobID == restoreJobID) {
+    restoreDone++;
+    if(value < 0) restoreFailed++;
+    else if(value == 0) restoreSkipped++;
+    else restoreWritten++;
+    ackManagerProg = RESTORE_WAIT_PROG;
+    return;
+  }
+
+  if(ackManagerJobID != sessionJobID) return;
+
+  if(value < 0) sessionFailed++;
+  else if(ackManagerType == WRITECV && value == 0) sessionSkipped++;
+  else if(ackManagerType == WRITECV) sessionWritten++;
+
+  // Carry on with the next operation as part of the same job
+  if(++sessionNext < sessionLength) {
+    loadSessionOp(sessionNext, false);
+    return;
+  }
+  sessionJobID = 0;
 }
\ No newline at end of file
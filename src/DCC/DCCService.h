@@ -22,12 +22,44 @@
 
 #include <Arduino.h>
 
+#include "../Diagnostics/LoopProfiler.h"
+#include "CVCache.h"
 #include "Waveform.h"
 #include "Queue.h"
 
 // Threshold (mA) that a sample must cross to ACK
 const uint8_t kACKThreshold = 20; 
 
+// While an ACK is expected the current is sampled every kAckSampleTicks 
+// waveform ticks, so pulse widths can be measured by counting samples.
+const uint8_t kAckSampleTicks = 9;
+const uint16_t kAckSampleMicros = kAckSampleTicks * kWaveformTickMicros;
+// Samples buffered until checkAck drains them, a power of two. Covers a 
+// main loop stall of about 8ms on AVR and 33ms elsewhere. Samples lost to a
+// longer stall make the instruction be sent again, up to kAckLostRetries 
+// times, before the job fails.
+#if defined(ARDUINO_ARCH_AVR)
+const uint8_t kAckSampleBufferSize = 32;
+#else
+const uint8_t kAckSampleBufferSize = 128;
+#endif
+const uint8_t kAckLostRetries = 3;
+// Samples below the threshold needed to end a pulse, so that a single noisy
+// sample doesn't split it in two
+const uint8_t kAckNoiseSamples = 2;
+
+// Resets after an instruction with no ACK before it counts as a NACK
+const uint8_t kAckTimeoutResets = 6;
+
+// Adaptive timing. Once kTimingObservations ACKs from the decoder selected
+// for caching have been timed, its instructions are repeated just often 
+// enough for it to answer, a NACK is called after fewer resets and fewer
+// resets are sent after a verify. Writes keep the full recovery time.
+const uint8_t kTimingObservations = 4;
+const uint8_t kMinProgRepeats = 4;      // 5 packets, the S-9.2.3 minimum
+const uint8_t kAckMarginPackets = 2;
+const uint8_t kAckMarginResets = 2;
+
 enum cv_edit_type : uint8_t {
   READCV,
   WRITECV,
@@ -59,10 +91,100 @@ enum ackOpCodes {
   STARTMERGE, // Clear bit and byte settings ready for merge pass 
   MERGE,      // Merge previous wack response with byte value and decrement bit 
               // number (use for reading CV bytes)
+  CB,         // callback(byte)
+  WAITCV,     // wait for the next CV of a restore to arrive
 };
 
 typedef void (*ACK_CALLBACK)(Print* stream, serviceModeResponse result);
 
+// Where a service mode request ended up in the job queue.
+struct serviceJobResponse {
+  uint16_t jobID;
+  uint8_t position;   // 0 if it started right away, else jobs ahead of it
+};
+
+// Job priorities. Higher runs first, equal priorities run in FIFO order.
+enum : uint8_t {
+  kServicePriorityLow = 0,
+  kServicePriorityNormal = 1,
+  kServicePriorityHigh = 2,
+};
+
+// Maximum number of service mode jobs waiting behind the running one, and of
+// operations in a programming session. An AVR has 2KB (Uno) or 8KB (Mega) of
+// RAM, so these and the restore buffer are kept to about 230 bytes there
+// instead of about 860.
+#if defined(ARDUINO_ARCH_AVR)
+const uint8_t kServiceJobQueueSize = 8;
+const uint8_t kSessionSize = 16;
+#else
+const uint8_t kServiceJobQueueSize = 32;
+const uint8_t kSessionSize = 48;
+#endif
+
+enum SessionOpKind : uint8_t {
+  kSessionRead,
+  kSessionWrite,
+  kSessionWriteIfDifferent,
+};
+
+struct sessionStatusResponse {
+  uint8_t length;
+  uint8_t done;
+  uint8_t written;
+  uint8_t skipped;
+  uint8_t failed;
+};
+
+// Result of identifying the decoder on the programming track. Values that
+// couldn't be read are -1.
+struct decoderIdentityResponse {
+  uint16_t callback;
+  uint16_t callbackSub;
+  int manufacturer;   // CV8
+  int version;        // CV7
+  int config;         // CV29
+  int address;        // CV1, or CV17/18 if CV29 selects the long address
+};
+
+typedef void (*IDENTIFY_CALLBACK)(Print* stream, 
+  decoderIdentityResponse result);
+
+// CVs reported per backup frame
+const uint8_t kBackupFrameSize = 8;
+
+// Part of a backup. A frame with a count of 0 ends the backup, its firstCV 
+// is then the CV to resume from (one past the last CV if it completed).
+struct backupFrameResponse {
+  uint16_t callback;
+  uint16_t callbackSub;
+  uint16_t firstCV;
+  uint8_t count;
+  int values[kBackupFrameSize];   // -1 if the CV couldn't be read
+};
+
+typedef void (*BACKUP_CALLBACK)(Print* stream, backupFrameResponse frame);
+
+// CVs of a restore image waiting to be written
+#if defined(ARDUINO_ARCH_AVR)
+const uint8_t kRestoreBufferSize = 8;
+#else
+const uint8_t kRestoreBufferSize = 32;
+#endif
+
+// A restore waiting this long for the next CV of an image that hasn't been
+// ended is given up, so a client that went away doesn't hold the track
+const uint16_t kRestoreIdleMillis = 10000;
+
+struct restoreStatusResponse {
+  uint8_t buffered;
+  uint16_t done;
+  uint16_t written;
+  uint16_t skipped;
+  uint16_t failed;
+  bool timedOut;    // The restore ended because no CV came for too long
+};
+
 class DCCService : public Waveform {
 public:
   DCCService(Board* board);
@@ -72,6 +194,7 @@ public:
   }
 
   void loop() {
+    LOOP_PROFILE_SCOPE(kSectionProgTrack);
     Waveform::loop(); // Checks for overcurrent and manages power
     ackManagerLoop();
   }
@@ -79,13 +202,91 @@ public:
   bool interrupt1();
   void interrupt2();
 
+  // Service mode operations are queued and run one at a time. Each returns 
+  // ERR_BUSY if the queue is full, otherwise ERR_OK with the job's ID and 
+  // queue position in response. The callback is always called exactly once
+  // for an accepted job, with a value of -1 if it failed or was cancelled.
+  // With ifDifferent the CV is verified first and the write skipped (result 
+  // 0 instead of 1) if it already holds the value.
   uint8_t writeCVByte(uint16_t cv, uint8_t bValue, uint16_t callback, 
-    uint16_t callbackSub, Print* stream, ACK_CALLBACK);
+    uint16_t callbackSub, Print* stream, ACK_CALLBACK, 
+    serviceJobResponse& response, uint8_t priority = kServicePriorityNormal,
+    bool ifDifferent = false);
   uint8_t writeCVBit(uint16_t cv, uint8_t bNum, uint8_t bValue, 
     uint16_t callback, uint16_t callbackSub, Print* stream, 
-    ACK_CALLBACK);
+    ACK_CALLBACK, serviceJobResponse& response, 
+    uint8_t priority = kServicePriorityNormal);
   uint8_t readCV(uint16_t cv, uint16_t callback, uint16_t callbackSub, Print* stream, 
-    ACK_CALLBACK);
+    ACK_CALLBACK, serviceJobResponse& response, 
+    uint8_t priority = kServicePriorityNormal, 
+    CVCacheMode cacheMode = kCacheVerify);
+  // Reads a CV by verifying the predicted value first. Costs one verify
+  // instead of nine when the prediction is right, and one extra when not.
+  uint8_t readCVPredicted(uint16_t cv, uint8_t predicted, uint16_t callback, 
+    uint16_t callbackSub, Print* stream, ACK_CALLBACK, 
+    serviceJobResponse& response, uint8_t priority = kServicePriorityNormal);
+
+  // A session is a list of reads and writes run back to back as one job. It
+  // takes a single baseline and sends fewer resets between operations. The
+  // callback gets a result for every operation. A decoder profile is a 
+  // session of write-if-different operations. The session can't be changed
+  // while it's running.
+  bool addSessionOp(SessionOpKind kind, uint16_t cv, uint8_t value = 0);
+  void clearSession();
+  uint8_t runSession(uint16_t callback, uint16_t callbackSub, Print* stream, 
+    ACK_CALLBACK, serviceJobResponse& response, 
+    uint8_t priority = kServicePriorityNormal);
+  uint8_t getSessionLength() { return sessionLength; }
+  bool getSessionStatus(sessionStatusResponse& response);
+
+  // Reads CV8, CV7, CV29 and the address CVs it selects as one job, with 
+  // the same short gaps as a session and verify-first reads where the value
+  // can be predicted. On success the decoder is selected for caching, so 
+  // identifying it again only takes a verify per CV. Only one identification
+  // can be queued or running at a time.
+  uint8_t identifyDecoder(uint16_t callback, uint16_t callbackSub, 
+    Print* stream, IDENTIFY_CALLBACK, serviceJobResponse& response, 
+    uint8_t priority = kServicePriorityNormal);
+
+  // Reads CVs firstCV to lastCV as one job and reports them in frames as
+  // they are read. Reads are verify-first where the value can be predicted
+  // and update the cache. A backup that was cancelled or cut short can be
+  // resumed by starting a new one at the CV given in the final frame. Only 
+  // one backup can be queued or running at a time.
+  uint8_t backupCVs(uint16_t firstCV, uint16_t lastCV, uint16_t callback, 
+    uint16_t callbackSub, Print* stream, BACKUP_CALLBACK, 
+    serviceJobResponse& response, uint8_t priority = kServicePriorityNormal);
+
+  // Writes an image as one job, with write-if-different so that only CVs 
+  // that changed are written. The image is added while the job runs, as 
+  // long as there is room in the buffer. The callback gets a result for 
+  // every CV, as in a session. The job ends once endRestore has been called 
+  // and the buffer is empty, or after waiting kRestoreIdleMillis for a CV.
+  uint8_t restoreCVs(uint16_t callback, uint16_t callbackSub, Print* stream, 
+    ACK_CALLBACK, serviceJobResponse& response, 
+    uint8_t priority = kServicePriorityNormal);
+  bool addRestoreCV(uint16_t cv, uint8_t value);
+  uint8_t getRestoreSpace() { 
+    return restoreJobID ? kRestoreBufferSize - restoreCount : 0; 
+  }
+  void endRestore() { restoreEnded = true; }
+  bool getRestoreStatus(restoreStatusResponse& response);
+
+  // Decoder whose CVs are cached by the jobs scheduled from now on. Results
+  // of reads and writes update its cache entries.
+  void selectCacheDecoder(uint8_t manufacturer, uint8_t version, 
+    uint16_t address);
+  void clearCacheDecoder() { cacheDecoder = kCVCacheNoDecoder; }
+  uint8_t getCacheDecoder() { return cacheDecoder; }
+
+  // Removes a job from the queue, or aborts it if it's running. Returns false
+  // if there's no such job.
+  bool cancelJob(uint16_t jobID);
+  // Number of jobs, including the running one
+  uint8_t jobCount() { return jobQueueCount + (ackManagerProg ? 1 : 0); }
+  // ID and CV of the job at a position (0 is the running one). Returns false
+  // if there's nothing there.
+  bool getJob(uint8_t position, uint16_t& jobID, uint16_t& cv);
 
 private:
   struct Packet {
@@ -101,12 +302,111 @@ private:
   void schedulePacket(const uint8_t buffer[], uint8_t byteCount, 
     uint8_t repeats, uint16_t identifier);  
 
-  // ACK MANAGER
-  void ackManagerSetup(uint16_t cv, uint8_t value, ackOpCodes const program[],
+  // JOB QUEUE
+  struct ServiceJob {
+    ackOpCodes const * program;
+    uint16_t cv;
+    uint8_t value;
+    cv_edit_type type;
+    uint8_t priority;
+    uint16_t jobID;
+    uint16_t callbackNum;
+    uint16_t callbackSub;
+    Print* stream;
+    ACK_CALLBACK callback;
+    uint8_t cacheDecoder;
+  };
+  // Waiting jobs, sorted by priority then age. jobQueue[0] runs next.
+  ServiceJob jobQueue[kServiceJobQueueSize];
+  uint8_t jobQueueCount = 0;
+  uint16_t nextJobID = 1;
+  uint8_t cacheDecoder = kCVCacheNoDecoder;
+  uint8_t scheduleJob(uint16_t cv, uint8_t value, ackOpCodes const program[],
     cv_edit_type type, uint16_t callbackNum, uint16_t callbackSub, 
-    Print* stream, ACK_CALLBACK callback);
+    Print* stream, ACK_CALLBACK callback, uint8_t priority, 
+    serviceJobResponse& response);
+  void startNextJob();
+  ackOpCodes const * writeProgram(uint16_t cv, uint8_t value, 
+    bool ifDifferent);
+
+  ackOpCodes const * readProgram(uint16_t cv, CVCacheMode cacheMode, 
+    uint8_t& predicted);
+
+  // SESSION
+  struct SessionOp {
+    uint16_t cv;
+    uint8_t value;
+    SessionOpKind kind;
+  };
+  SessionOp session[kSessionSize];
+  uint8_t sessionLength = 0;
+  uint8_t sessionNext = 0;      // Operation being run
+  uint16_t sessionJobID = 0;    // 0 unless the session is queued or running
+  uint8_t sessionWritten = 0;
+  uint8_t sessionSkipped = 0;
+  uint8_t sessionFailed = 0;
+  // Resets between operations of a session, instead of kResetRepeats. Still 
+  // enough for a decoder that has just answered a verify (S-9.2.3).
+  const uint8_t kSessionResetRepeats = 3;
+  void loadSessionOp(uint8_t index, bool baseline);
+  uint8_t verifyResets() { 
+    return batchJob() ? kSessionResetRepeats : ackManagerVerifyResets;
+  }
+  // Whether the running job strings several operations together
+  bool batchJob() {
+    return ackManagerJobID == sessionJobID || 
+      ackManagerJobID == identifyJobID || ackManagerJobID == backupJobID ||
+      ackManagerJobID == restoreJobID;
+  }
+
+  // IDENTIFY
+  uint16_t identifyJobID = 0;   // 0 unless an identification is queued or running
+  static const uint8_t kIdentifySteps = 5;
+  uint8_t identifyStep = 0;     // Also the number of CVs read so far
+  uint8_t identifyValues[kIdentifySteps];
+  decoderIdentityResponse identity;
+  IDENTIFY_CALLBACK identifyCallback = NULL;
+  Print* identifyStream = NULL;
+  uint16_t identifyCV(uint8_t step);
+  void loadIdentifyStep(bool baseline);
+  void identifyResult(int value);
+  void finishIdentify();
+
+  // BACKUP AND RESTORE
+  uint16_t backupJobID = 0;     // 0 unless a backup is queued or running
+  uint16_t backupNext = 0;      // CV being read
+  uint16_t backupLast = 0;
+  backupFrameResponse backupFrame;
+  BACKUP_CALLBACK backupCallback = NULL;
+  Print* backupStream = NULL;
+  void loadBackupCV(bool baseline);
+  void backupResult(int value);
+  void sendBackupFrame();
+  void finishBackup();
+
+  struct RestoreCV {
+    uint16_t cv;
+    uint8_t value;
+  };
+  RestoreCV restoreBuffer[kRestoreBufferSize];
+  uint8_t restoreHead = 0;      // Next CV to write
+  uint8_t restoreCount = 0;
+  bool restoreEnded = false;
+  bool restoreBaseline = false; // Taken by the first CV written
+  bool restoreWaiting = false;  // Waiting for a CV since restoreWaitStart
+  uint32_t restoreWaitStart = 0;
+  bool restoreTimedOut = false;
+  uint16_t restoreJobID = 0;    // 0 unless a restore is queued or running
+  uint16_t restoreDone = 0;
+  uint16_t restoreWritten = 0;
+  uint16_t restoreSkipped = 0;
+  uint16_t restoreFailed = 0;
+  void loadRestoreCV();
+  
+  // ACK MANAGER
   void ackManagerLoop();
-  void callback(Print* stream, serviceModeResponse value);
+  // Ends the running job and reports value (-1 for failure) to its callback
+  void finishJob(int value);
   ackOpCodes const * ackManagerProg = NULL;
   uint8_t ackManagerByte = 0;
   uint8_t ackManagerBitNum = 0;
@@ -118,6 +418,18 @@ private:
   uint16_t ackManagerCallbackNum = 0;
   uint16_t ackManagerCallbackSub = 0;
   cv_edit_type ackManagerType = READCV;
+  uint16_t ackManagerJobID = 0;
+  uint8_t ackManagerCacheDecoder = kCVCacheNoDecoder;
+  uint8_t ackManagerResets = 0;   // Resets needed before the next packet
+  ackOpCodes const * ackManagerProgStart = NULL;
+  // Timing of this job's instructions, see applyTiming
+  uint8_t ackManagerRepeats = kProgRepeats;
+  uint8_t ackManagerTimeout = kAckTimeoutResets;
+  uint8_t ackManagerVerifyResets = kResetRepeats;
+  bool ackManagerAdapted = false;
+  void applyTiming();
+  void recordTiming();
+  void forgetTiming();
   Print* responseStream;
 
   uint8_t cv1(uint8_t opcode, uint16_t cv)  {
@@ -132,11 +444,35 @@ private:
   uint8_t transmitResetCount = 0;   // Tracks resets sent since last payload packet
 
   void setAckPending();
+  // 2 while pending, 1 for an ACK, 0 for none and 3 if samples were lost
   uint8_t didAck();
   void checkAck();
+  // Feeds one current sample to the pulse detector, true once a pulse of 
+  // valid width has ended
+  bool ackSample(uint16_t current);
   uint16_t lastCurrent = 0;
   bool ackPending = false;
   bool ackDetected = false; 
+  bool ackLost = false;
+  uint8_t ackLostRetries = 0;   // Times the current instruction was resent
+
+  // Written by interrupt1, read by checkAck
+  uint16_t ackSamples[kAckSampleBufferSize];
+  volatile uint8_t ackSampleHead = 0;
+  volatile uint8_t ackSampleTail = 0;
+  volatile bool ackSampling = false;
+  volatile bool ackSamplesDropped = false;  // The buffer was full
+  // Set by ackSample to cut the instruction's repeats short, taken by 
+  // interrupt2 at the end of the packet
+  volatile bool ackCutRepeats = false;
+  uint8_t ackSampleTick = 0;
+  // Pulse being measured, in samples. 0 if none.
+  uint8_t ackPulseSamples = 0;
+  uint8_t ackLowSamples = 0;
+  bool ackPulseTooLong = false;
+  // When the pulse started, for adaptive timing
+  uint8_t ackEdgePackets = 0;
+  uint8_t ackEdgeResets = 0;
 
   // NMRA codes #
   const uint8_t SET_SPEED = 0x3f;
@@ -20,50 +20,49 @@
 #include "DCCService.h"
 
 bool DCCService::interrupt1() {
-  switch (interruptState) {
-  case 0:   // start of bit transmission
-    board->signal(HIGH);    
-    interruptState = 1; 
-    return true; // must call interrupt2 to set currentBit
-  // Case 1 falls to default case
-  case 2:   // 58us after case 0
-    if(currentBit) {
-      board->signal(LOW);  
-    }
-    interruptState = 3;
-    break; 
-  case 3:   // 87us after case 0
-    if(currentBit) {
-      // Return to case zero for start of another bit at 116us
-      interruptState = 0;
-    }
-    else interruptState = 4;
-    break;
-  case 4:   // 116us after case 0
+  ISR_STATS_SCOPE(isrStats, kIsrInterrupt1);
+
+  // No railcom on the programming track, so kWaveCutout is never selected.
+  uint8_t action = nextWaveAction();
+
+  if(action & kWaveSignalHigh) {
+    board->signal(HIGH);
+  }
+  if(action & kWaveSignalLow) {
     board->signal(LOW);
-    interruptState = 5;
-    break;
-  // Case 5 and 6 fall to default case
-  case 7:   // 203us after case 0
-    interruptState = 0; 
-    break;
-  default:
-    interruptState++;
-    break;
   }
-  
-  return false;   // Don't call interrupt2
+
+  // After the signal, so the edges keep their timing
+  CurrentSampler::tick();
+
+  // Fixed rate current samples for ACK detection, drained by checkAck. A
+  // full buffer drops the sample. The sample comes from the sampler's ring
+  // and never waits for the ADC or touches it.
+  if(ackSampling && ++ackSampleTick >= kAckSampleTicks) {
+    ackSampleTick = 0;
+    uint8_t next = (ackSampleHead + 1) & (kAckSampleBufferSize - 1);
+    if(next != ackSampleTail) {
+      ackSamples[ackSampleHead] = board->getCurrentRaw();
+      ackSampleHead = next;
+    }
+    else ackSamplesDropped = true;
+  }
+
+  // If the bit is starting, interrupt2 must be called to pick the next one
+  return action & kWaveFetchBit;
 }
 
 void DCCService::interrupt2() {
+  ISR_STATS_SCOPE(isrStats, kIsrInterrupt2);
+
   if (remainingPreambles > 0 ) {    // If there's more preambles to be sent
-    currentBit=true;                // Send a one bit (preambles are one)
+    bitKind=kWaveOne;               // Send a one bit (preambles are one)
     remainingPreambles--;   // decrement the number of preambles to send
     return;
   }
   
   // beware OF 9-BIT MASK  generating a zero to start each byte   
-  currentBit=transmitPacket[bytes_sent] & kBitMask[bits_sent];
+  bitKind=(transmitPacket[bytes_sent] & kBitMask[bits_sent]) ? kWaveOne : kWaveZero;
   bits_sent++;
 
   // If this is the last bit of a byte, prepare for the next byte 
@@ -79,6 +78,12 @@ void DCCService::interrupt2() {
 
       int pendingCount = packetQueue.count();
 
+      // An ACK has been seen, the rest of the repeats aren't needed
+      if (ackCutRepeats) {
+        ackCutRepeats = false;
+        transmitRepeats = 0;
+      }
+
       // Note that the number of repeats does not include the final repeat, so
       // the number of times transmitted is nRepeats+1
       if (transmitRepeats > 0) {
@@ -0,0 +1,47 @@
+/*
+ *  IsrStats.cpp
+ * 
+ *  This file is part of CommandStation.
+ *
+ *  CommandStation is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  CommandStation is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with CommandStation.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include "IsrStats.h"
+
+void IsrStats::reset() {
+  for(uint8_t i = 0; i < kIsrStatsKinds; i++) histograms[i].reset();
+  haveEntry = false;
+}
+
+void IsrStats::enter1() {
+  uint32_t now = isrStatsCounter();
+#if defined(ARDUINO_ARCH_AVR)
+  histograms[kIsrLatency].add(now);
+#else
+  if(haveEntry) {
+    uint32_t period = isrStatsElapsed(lastEntry, now);
+    uint32_t late = period > kIsrStatsPeriod ? period - kIsrStatsPeriod 
+      : kIsrStatsPeriod - period;
+    histograms[kIsrLatency].add(late > 0xFFFF ? 0xFFFF : late);
+  }
+  lastEntry = now;
+  haveEntry = true;
+#endif
+}
+
+void IsrStats::exit(IsrStatsKind kind, uint32_t start) {
+  uint32_t elapsed = isrStatsElapsed(start, isrStatsCounter());
+  histograms[kind].add(elapsed > 0xFFFF ? 0xFFFF : elapsed);
+}
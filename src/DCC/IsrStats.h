@@ -0,0 +1,106 @@
+/*
+ *  IsrStats.h
+ * 
+ *  This file is part of CommandStation.
+ *
+ *  CommandStation is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  CommandStation is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with CommandStation.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef COMMANDSTATION_DCC_ISRSTATS_H_
+#define COMMANDSTATION_DCC_ISRSTATS_H_
+
+#include <Arduino.h>
+
+#include "../Diagnostics/TimingHistogram.h"
+#include "WaveformSchedule.h"
+
+// Optional timing instrumentation for the waveform ISR. Build with 
+// DCC_ISR_STATS defined to enable it; otherwise the macros at the bottom of 
+// this file compile to nothing.
+//
+// Times are in counter ticks:
+//  - SAMD/SAMC: CPU cycles from SysTick. Latency is how far the time between
+//    two calls to interrupt1 strays from the nominal timer period.
+//  - AVR: Timer1 ticks. The sketch runs the waveform timer on Timer1 in CTC 
+//    mode, so TCNT1 on entry is the time since the compare match fired. An
+//    overrun of up to one more period is measured from the OCF1A flag.
+//  - Anything else: micros(), latency as on SAMD.
+
+enum IsrStatsKind : uint8_t {
+  kIsrLatency,      // Lateness of interrupt1 relative to the timer
+  kIsrInterrupt1,   // Time spent in interrupt1
+  kIsrInterrupt2,   // Time spent in interrupt2
+  kIsrStatsKinds
+};
+
+struct IsrStats {
+  TimingHistogram histograms[kIsrStatsKinds];
+  uint32_t lastEntry;   // Counter value the last time interrupt1 started
+  bool haveEntry;
+
+  void reset();
+  void enter1();
+  void exit(IsrStatsKind kind, uint32_t start);
+};
+
+#if defined(ARDUINO_ARCH_SAMD) || defined(ARDUINO_ARCH_SAMC)
+// SysTick counts down from LOAD to zero at the CPU clock
+inline uint32_t isrStatsCounter() { return SysTick->VAL; }
+inline uint32_t isrStatsElapsed(uint32_t start, uint32_t end) {
+  return start >= end ? start - end : start + SysTick->LOAD + 1 - end;
+}
+const uint32_t kIsrStatsPeriod = (F_CPU / 1000000) * kWaveformTickMicros;
+#elif defined(ARDUINO_ARCH_AVR)
+// TCNT1 goes back to zero at OCR1A. The compare match that does so sets
+// OCF1A again, which was cleared on entry to the ISR, so a counter read after
+// it is moved on by a period. Only the first wrap can be seen this way.
+inline uint32_t isrStatsCounter() {
+  uint16_t count = TCNT1;
+  if(TIFR1 & _BV(OCF1A)) return (uint32_t)TCNT1 + OCR1A + 1;
+  return count;
+}
+inline uint32_t isrStatsElapsed(uint32_t start, uint32_t end) {
+  return end - start;
+}
+#else
+inline uint32_t isrStatsCounter() { return micros(); }
+inline uint32_t isrStatsElapsed(uint32_t start, uint32_t end) {
+  return end - start;
+}
+const uint32_t kIsrStatsPeriod = kWaveformTickMicros;
+#endif
+
+// Records the time spent in the enclosing interrupt1/interrupt2 body when it
+// goes out of scope, so early returns are covered.
+class IsrStatsScope {
+public:
+  IsrStatsScope(IsrStats& stats, IsrStatsKind kind) 
+    : stats(stats), kind(kind), start(isrStatsCounter()) {
+    if(kind == kIsrInterrupt1) stats.enter1();
+  }
+  ~IsrStatsScope() { stats.exit(kind, start); }
+private:
+  IsrStats& stats;
+  IsrStatsKind kind;
+  uint32_t start;
+};
+
+#if defined(DCC_ISR_STATS)
+#define ISR_STATS_SCOPE(stats, kind) IsrStatsScope isrStatsScope(stats, kind)
+#else
+#define ISR_STATS_SCOPE(stats, kind)
+#endif
+
+#endif  // COMMANDSTATION_DCC_ISRSTATS_H_
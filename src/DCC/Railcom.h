@@ -83,7 +83,8 @@ enum PacketType : uint8_t {
   kPOMLongReadType,
   kSrvcByteWriteType,
   kSrvcBitWriteType,
-  kSrvcReadType
+  kSrvcReadType,
+  kPacketTypes
 };
 
 struct RailcomDatagram {
@@ -23,6 +23,8 @@
 #include <Arduino.h>
 
 #include "../Boards/Board.h"
+#include "IsrStats.h"
+#include "WaveformSchedule.h"
 
 const uint8_t kIdlePacket[] = {0xFF,0x00,0xFF};
 const uint8_t kResetPacket[] = {0x00,0x00,0x00};
@@ -45,11 +47,18 @@ public:
   }
 
   Board* board;
+
+#if defined(DCC_ISR_STATS)
+  Waveform() { isrStats.reset(); }
+
+  // Timing of interrupt1/interrupt2, read and reset with interrupts off
+  IsrStats isrStats;
+#endif
 protected:
   // Data that controls the packet currently being sent out.
   uint8_t bits_sent;  // Bits sent from byte
   uint8_t bytes_sent; // Bytes sent from packet
-  uint8_t currentBit = false;
+  uint8_t bitKind = kWaveOne; // WaveBitKind of the bit being sent
   uint8_t transmitRepeats = 0;  // Repeats (does not include initial transmit)
   uint8_t remainingPreambles = 0; 
   uint8_t generateStartBit = false;  // Send a start bit for the current byte?
@@ -59,7 +68,14 @@ protected:
 
   // Interrupt segments, called in interrupt_handler
   
-  uint8_t interruptState = 0; // Waveform generator state
+  uint8_t interruptState = 0; // Tick within the current bit
+
+  // Looks up what to do on this tick and moves on to the next one.
+  inline uint8_t nextWaveAction() {
+    uint8_t action = DefaultWaveformTable::actions[bitKind][interruptState];
+    interruptState = (action & kWaveEndBit) ? 0 : interruptState + 1;
+    return action;
+  }
 
   uint16_t counterID = 1; // Maintains the last assigned packet ID
   bool counterWrap = false;
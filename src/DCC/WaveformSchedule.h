@@ -0,0 +1,117 @@
+/*
+ *  WaveformSchedule.h
+ *
+ *  This file is part of CommandStation.
+ *
+ *  CommandStation is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  CommandStation is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with CommandStation.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef COMMANDSTATION_DCC_WAVEFORMSCHEDULE_H_
+#define COMMANDSTATION_DCC_WAVEFORMSCHEDULE_H_
+
+#include <Arduino.h>
+
+// Period of the waveform timer, set up by the sketch (micros)
+const uint8_t kWaveformTickMicros = 29;
+
+// Kinds of bit the waveform generator can put on the track. Each one selects a
+// row of the action table below.
+enum WaveBitKind : uint8_t {
+  kWaveOne,     // Standard one bit
+  kWaveZero,    // Standard zero bit
+  kWaveCutout,  // First preamble bit, replaced by a railcom cutout
+  kWaveBitKinds
+};
+
+// Actions taken on a single timer tick. More than one may be set.
+enum : uint8_t {
+  kWaveSignalHigh = 0x01,   // Drive the signal high (start of a bit)
+  kWaveSignalLow = 0x02,    // Drive the signal low (second half of a bit)
+  kWaveCutoutStart = 0x04,  // Short the track outputs and listen for railcom
+  kWaveCutoutEnd = 0x08,    // Release the cutout and read the railcom data
+  kWaveFetchBit = 0x10,     // interrupt2 must run to pick the next bit kind
+  kWaveEndBit = 0x20,       // Last tick of this bit, go back to tick 0
+};
+
+// Describes the timing of the waveform in ticks of the waveform timer (29us).
+// One and zero bits are given as the length of each half of the bit, the
+// cutout as the ticks (counted from the start of the bit) where it begins and
+// ends. The signal goes low on the end tick and stays there for one tick.
+template<uint8_t OneHalfTicks, uint8_t ZeroHalfTicks, uint8_t CutoutStartTick,
+  uint8_t CutoutEndTick>
+struct WaveformSchedule {
+  static_assert(OneHalfTicks > 0, "a one bit needs at least one tick per half");
+  static_assert(ZeroHalfTicks > OneHalfTicks, "zero bits must be longer than one bits");
+  static_assert(CutoutStartTick > 0 && CutoutStartTick < CutoutEndTick,
+    "the cutout must start after the bit starts and end after it starts");
+
+  // Number of ticks needed by the longest bit
+  static constexpr uint8_t kTicks =
+    (2 * ZeroHalfTicks > CutoutEndTick + 1) ? 2 * ZeroHalfTicks : CutoutEndTick + 1;
+
+  // Preamble bits taken up by a cutout. The stretched bit consumes this many
+  // one bits worth of time, so they are dropped from the preamble count.
+  static constexpr uint8_t kCutoutPreambles = (CutoutEndTick + 1) / (2 * OneHalfTicks);
+
+  static constexpr uint8_t bitAction(uint8_t halfTicks, uint8_t tick) {
+    return (tick == 0 ? (kWaveSignalHigh | kWaveFetchBit) : 0)
+      | (tick == halfTicks ? kWaveSignalLow : 0)
+      | (tick == 2 * halfTicks - 1 ? kWaveEndBit : 0);
+  }
+
+  static constexpr uint8_t cutoutAction(uint8_t tick) {
+    return (tick == 0 ? (kWaveSignalHigh | kWaveFetchBit) : 0)
+      | (tick == CutoutStartTick ? kWaveCutoutStart : 0)
+      | (tick == CutoutEndTick ? (kWaveCutoutEnd | kWaveSignalLow | kWaveEndBit) : 0);
+  }
+
+  static constexpr uint8_t action(uint8_t kind, uint8_t tick) {
+    return kind == kWaveOne ? bitAction(OneHalfTicks, tick)
+      : kind == kWaveZero ? bitAction(ZeroHalfTicks, tick)
+      : cutoutAction(tick);
+  }
+};
+
+// Compile time list of tick numbers, used to expand the table rows.
+template<uint8_t... Ticks> struct WaveTickList {};
+template<uint8_t N, uint8_t... Ticks>
+struct MakeWaveTickList : MakeWaveTickList<N - 1, N - 1, Ticks...> {};
+template<uint8_t... Ticks>
+struct MakeWaveTickList<0, Ticks...> { typedef WaveTickList<Ticks...> type; };
+
+template<class Schedule, class TickList> struct WaveformTable;
+
+template<class Schedule, uint8_t... Ticks>
+struct WaveformTable<Schedule, WaveTickList<Ticks...>> {
+  static const uint8_t actions[kWaveBitKinds][sizeof...(Ticks)];
+};
+
+// Rows are indexed by WaveBitKind, columns by tick. Kept in RAM so the ISR
+// gets a single load per tick.
+template<class Schedule, uint8_t... Ticks>
+const uint8_t WaveformTable<Schedule, WaveTickList<Ticks...>>::actions
+  [kWaveBitKinds][sizeof...(Ticks)] = {
+  { Schedule::action(kWaveOne, Ticks)... },
+  { Schedule::action(kWaveZero, Ticks)... },
+  { Schedule::action(kWaveCutout, Ticks)... },
+};
+
+// NMRA S-9.1 timing: 58us halves for a one, 116us halves for a zero. The
+// railcom cutout starts 29us after the end bit and lasts 435us (S-9.3.2).
+typedef WaveformSchedule<2, 4, 1, 16> DefaultWaveformSchedule;
+
+typedef WaveformTable<DefaultWaveformSchedule,
+  MakeWaveTickList<DefaultWaveformSchedule::kTicks>::type> DefaultWaveformTable;
+
+#endif  // COMMANDSTATION_DCC_WAVEFORMSCHEDULE_H_
@@ -0,0 +1,85 @@
+/*
+ *  LoopProfiler.cpp
+ * 
+ *  This file is part of CommandStation.
+ *
+ *  CommandStation is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  CommandStation is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with CommandStation.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include "LoopProfiler.h"
+
+#if defined(DCC_LOOP_PROFILE)
+
+// Budgets are in micros
+LoopSectionStats LoopProfiler::stats[kLoopSections] = {
+  {{}, 5000, 0},  // kSectionLoop
+  {{}, 1000, 0},  // kSectionMainTrack
+  {{}, 1000, 0},  // kSectionProgTrack
+  {{}, 500, 0},   // kSectionRailcom
+  {{}, 2000, 0},  // kSectionComms
+  {{}, 1000, 0},  // kSectionSensors
+};
+unsigned long LoopProfiler::lastLoopStart = 0;
+unsigned long LoopProfiler::rateWindowStart = 0;
+uint16_t LoopProfiler::loopsInWindow = 0;
+uint16_t LoopProfiler::loopRate = 0;
+uint8_t LoopProfiler::overrunFlags = 0;
+
+void LoopProfiler::reset() {
+  for(uint8_t i = 0; i < kLoopSections; i++) {
+    stats[i].time.reset();
+    stats[i].overruns = 0;
+  }
+  lastLoopStart = 0;
+  loopsInWindow = 0;
+  overrunFlags = 0;
+}
+
+void LoopProfiler::loopStart() {
+  unsigned long now = micros();
+  if(lastLoopStart != 0) {
+    unsigned long elapsed = now - lastLoopStart;
+    record(kSectionLoop, elapsed > 0xFFFF ? 0xFFFF : elapsed);
+  }
+  lastLoopStart = now;
+
+  loopsInWindow++;
+  if(millis() - rateWindowStart >= 1000) {
+    rateWindowStart = millis();
+    loopRate = loopsInWindow;
+    loopsInWindow = 0;
+  }
+}
+
+void LoopProfiler::record(LoopSection section, uint16_t micros) {
+  LoopSectionStats& s = stats[section];
+  s.time.add(micros);
+  if(micros > s.budget) {
+    if(s.overruns < 0xFFFF) s.overruns++;
+    overrunFlags |= 1 << section;
+  }
+}
+
+void LoopProfiler::setBudget(LoopSection section, uint16_t micros) {
+  stats[section].budget = micros;
+}
+
+uint8_t LoopProfiler::takeOverrunFlags() {
+  uint8_t flags = overrunFlags;
+  overrunFlags = 0;
+  return flags;
+}
+
+#endif  // DCC_LOOP_PROFILE
@@ -0,0 +1,98 @@
+/*
+ *  LoopProfiler.h
+ * 
+ *  This file is part of CommandStation.
+ *
+ *  CommandStation is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  CommandStation is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with CommandStation.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef COMMANDSTATION_DIAGNOSTICS_LOOPPROFILER_H_
+#define COMMANDSTATION_DIAGNOSTICS_LOOPPROFILER_H_
+
+#include <Arduino.h>
+
+#include "TimingHistogram.h"
+
+// Optional main loop profiler. Build with DCC_LOOP_PROFILE defined to enable
+// it; otherwise LOOP_PROFILE_SCOPE compiles to nothing, loopStart does 
+// nothing and the statistics take no memory.
+
+// Parts of the main loop that are timed. Each one times itself, the sketch 
+// only needs to call LoopProfiler::loopStart() at the top of loop().
+enum LoopSection : uint8_t {
+  kSectionLoop,       // A whole pass through the sketch's loop()
+  kSectionMainTrack,  // DCCMain::loop, less railcom
+  kSectionProgTrack,  // DCCService::loop
+  kSectionRailcom,    // Railcom::processData
+  kSectionComms,      // CommManager::update, including command parsing
+  kSectionSensors,    // Sensor::check
+  kLoopSections
+};
+
+struct LoopSectionStats {
+  TimingHistogram time;   // micros per call
+  uint16_t budget;
+  uint16_t overruns;      // Calls that went over budget
+};
+
+class LoopProfiler {
+public:
+  static void reset();
+  // Marks the start of a new pass through loop(), timing the previous one
+#if defined(DCC_LOOP_PROFILE)
+  static void loopStart();
+#else
+  static void loopStart() {}
+#endif
+  static void record(LoopSection section, uint16_t micros);
+  static void setBudget(LoopSection section, uint16_t micros);
+
+  static const LoopSectionStats& getStats(LoopSection section) {
+    return stats[section];
+  }
+  // Loops per second over the last complete second
+  static uint16_t getLoopRate() { return loopRate; }
+  // Bit per section that has gone over budget since the last call
+  static uint8_t takeOverrunFlags();
+
+private:
+  static LoopSectionStats stats[kLoopSections];
+  static unsigned long lastLoopStart;
+  static unsigned long rateWindowStart;
+  static uint16_t loopsInWindow;
+  static uint16_t loopRate;
+  static uint8_t overrunFlags;
+};
+
+// Times the enclosing block as one call of a loop section.
+class LoopProfileScope {
+public:
+  LoopProfileScope(LoopSection section) : section(section), start(micros()) {}
+  ~LoopProfileScope() {
+    unsigned long elapsed = micros() - start;
+    LoopProfiler::record(section, elapsed > 0xFFFF ? 0xFFFF : elapsed);
+  }
+private:
+  LoopSection section;
+  unsigned long start;
+};
+
+#if defined(DCC_LOOP_PROFILE)
+#define LOOP_PROFILE_SCOPE(section) LoopProfileScope loopProfileScope(section)
+#else
+#define LOOP_PROFILE_SCOPE(section)
+#endif
+
+#endif  // COMMANDSTATION_DIAGNOSTICS_LOOPPROFILER_H_
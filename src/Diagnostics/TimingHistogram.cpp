@@ -0,0 +1,67 @@
+/*
+ *  TimingHistogram.cpp
+ * 
+ *  This file is part of CommandStation.
+ *
+ *  CommandStation is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  CommandStation is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with CommandStation.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include "TimingHistogram.h"
+
+void TimingHistogram::reset() {
+  memset(this, 0, sizeof(*this));
+}
+
+void TimingHistogram::add(uint16_t value) {
+  // Keep the mean meaningful instead of overflowing
+  if(total > 0xF0000000UL) {
+    total >>= 1;
+    count >>= 1;
+  }
+  if(count == 0 || value < min) min = value;
+  count++;
+  total += value;
+  if(value > max) max = value;
+
+  uint8_t bucket = 0;
+  while(value) {
+    value >>= 1;
+    bucket++;
+  }
+  if(bucket >= kHistogramBuckets) bucket = kHistogramBuckets - 1;
+  
+  // Halve everything rather than saturate, so the shape is kept
+  if(buckets[bucket] == 0xFFFF) {
+    for(uint8_t i = 0; i < kHistogramBuckets; i++) buckets[i] >>= 1;
+  }
+  buckets[bucket]++;
+}
+
+uint16_t TimingHistogram::percentile(uint8_t percent) const {
+  // Buckets may have been halved, so they're counted rather than using count
+  uint32_t samples = 0;
+  for(uint8_t i = 0; i < kHistogramBuckets; i++) samples += buckets[i];
+  if(samples == 0) return 0;
+
+  uint32_t seen = 0;
+  for(uint8_t i = 0; i < kHistogramBuckets; i++) {
+    seen += buckets[i];
+    if(seen * 100 >= samples * percent) {
+      uint16_t upper = i == 0 ? 0 : (uint16_t)((1UL << i) - 1);
+      return upper < max ? upper : max;
+    }
+  }
+  return max;
+}
@@ -0,0 +1,45 @@
+/*
+ *  TimingHistogram.h
+ * 
+ *  This file is part of CommandStation.
+ *
+ *  CommandStation is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  CommandStation is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with CommandStation.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef COMMANDSTATION_DIAGNOSTICS_TIMINGHISTOGRAM_H_
+#define COMMANDSTATION_DIAGNOSTICS_TIMINGHISTOGRAM_H_
+
+#include <Arduino.h>
+
+// Log2 buckets: bucket n holds values from 2^(n-1) to 2^n - 1, bucket 0 holds 0
+const uint8_t kHistogramBuckets = 16;
+
+// Running statistics of a duration, cheap enough to update from an ISR. All
+// zeros is a valid empty histogram.
+struct TimingHistogram {
+  uint32_t count;
+  uint32_t total;
+  uint16_t min;
+  uint16_t max;
+  uint16_t buckets[kHistogramBuckets];
+
+  void reset();
+  void add(uint16_t value);
+  uint16_t mean() const { return count ? total / count : 0; }
+  // Upper bound of the bucket holding the given percentile
+  uint16_t percentile(uint8_t percent) const;
+};
+
+#endif  // COMMANDSTATION_DIAGNOSTICS_TIMINGHISTOGRAM_H_